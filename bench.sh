@@ -0,0 +1,112 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "${SCRIPT_DIR}"
+
+# local benchmark: receiver + sender on this host over the chosen transport
+# shm needs no RDMA device; latency/bandwidth model via RDMA_SIM_SHM_LAT_US / RDMA_SIM_SHM_BW_MBPS
+# tcp uses RDMA_SIM_TCP_STREAMS parallel data streams
+# auto takes the same-host shm fast path on a local address, otherwise verbs with tcp fallback
+# local runs auto (same-host fast path) and verbs (rxe loopback) back to back and compares them
+# post compares doorbell-batched WR posting with per-call posting (POST_TRANSPORT, default verbs)
+# REPLICAS=N chains N receivers (ports PORT..PORT+N-1) to time chained replication
+# RDMA_SIM_RATE_MBPS / RDMA_SIM_PEER_RATE_MBPS cap the sender; the result then reports pacing accuracy
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <verbs|shm|tcp|auto|local|post> <size_mb> [port] [ip]"
+  echo "Example: RDMA_SIM_SHM_BW_MBPS=1000 $0 shm 256"
+  exit 1
+fi
+
+TRANSPORT="$1"
+SIZE_MB="$2"
+PORT="${3:-18600}"
+IP="${4:-127.0.0.1}"
+REPLICAS="${REPLICAS:-1}"
+
+if [ "${TRANSPORT}" = "local" ]; then
+  # the rxe device must be bound to IP for the verbs run (see rdma.md: 启用 Soft-RoCE)
+  FAST="$("$0" auto "${SIZE_MB}" "${PORT}" "${IP}")"
+  echo "${FAST}"
+  if ! SLOW="$("$0" verbs "${SIZE_MB}" "$((PORT + 100))" "${IP}")"; then
+    echo "[bench] verbs run failed (no rxe device on ${IP}?)"
+    exit 1
+  fi
+  echo "${SLOW}"
+  awk -v a="${FAST}" -v b="${SLOW}" 'BEGIN {
+    ta = a; sub(/.*time=/, "", ta); sub(/us.*/, "", ta)
+    tb = b; sub(/.*time=/, "", tb); sub(/us.*/, "", tb)
+    printf "[bench] same-host fast path speedup over rxe loopback: %.2fx\n", tb / ta
+  }'
+  exit 0
+fi
+
+if [ "${TRANSPORT}" = "post" ]; then
+  # post_rate counts only the time spent inside the post calls: WRs per second per core
+  PT="${POST_TRANSPORT:-verbs}"
+  BATCHED="$(RDMA_SIM_POST_BATCH=1 "$0" "${PT}" "${SIZE_MB}" "${PORT}" "${IP}")"
+  PERCALL="$(RDMA_SIM_POST_BATCH=0 "$0" "${PT}" "${SIZE_MB}" "$((PORT + 100))" "${IP}")"
+  echo "${BATCHED} mode=batched"
+  echo "${PERCALL} mode=per-call"
+  awk -v a="${BATCHED}" -v b="${PERCALL}" 'BEGIN {
+    ra = a; sub(/.*post_rate=/, "", ra); sub(/WR.*/, "", ra)
+    rb = b; sub(/.*post_rate=/, "", rb); sub(/WR.*/, "", rb)
+    if (rb > 0) printf "[bench] batched post rate: %.2fx per-call\n", ra / rb
+  }'
+  exit 0
+fi
+
+WORK="$(mktemp -d /tmp/rdma_bench.XXXXXX)"
+RECV_PIDS=()
+cleanup() {
+  for pid in "${RECV_PIDS[@]}"; do kill "${pid}" >/dev/null 2>&1 || true; done
+  # the peer cap lives in shared memory and would outlive this run
+  if [ -n "${RDMA_SIM_PEER_RATE_MBPS:-}" ]; then ./bin/pacectl "${IP}" peer 0 >/dev/null 2>&1 || true; fi
+  rm -rf "${WORK}"
+}
+trap cleanup EXIT
+
+head -c "$((SIZE_MB * 1024 * 1024))" /dev/urandom > "${WORK}/bench.bin"
+
+export RDMA_SIM_TRANSPORT="${TRANSPORT}"
+
+# start from the tail of the chain so every next hop is already listening
+for ((i = REPLICAS - 1; i >= 0; i--)); do
+  mkdir -p "${WORK}/out${i}"
+  NEXT=()
+  if [ "${i}" -lt "$((REPLICAS - 1))" ]; then NEXT=("${IP}" "$((PORT + i + 1))"); fi
+  ./bin/receiver "${IP}" "$((PORT + i))" "${WORK}/out${i}" "${NEXT[@]}" > "${WORK}/receiver${i}.log" 2>&1 &
+  RECV_PIDS+=($!)
+done
+sleep 0.5
+
+START=$(date +%s%N)
+./bin/sender "${IP}" "${PORT}" "${WORK}/bench.bin" > "${WORK}/sender.log" 2>&1
+for pid in "${RECV_PIDS[@]}"; do wait "${pid}"; done
+RECV_PIDS=()
+END=$(date +%s%N)
+
+for ((i = 0; i < REPLICAS; i++)); do
+  cmp -s "${WORK}/bench.bin" "${WORK}/out${i}/bench.bin" || { echo "[bench] data mismatch on replica ${i}"; exit 1; }
+done
+
+ELAPSED_US=$(( (END - START) / 1000 ))
+MBPS=$(awk -v mb="${SIZE_MB}" -v us="${ELAPSED_US}" 'BEGIN { printf "%.1f", mb / (us / 1e6) }')
+VIA="$(sed -n 's/^\[sender\] connected via //p' "${WORK}/sender.log")"
+POST_RATE="$(sed -n 's/^\[sender\] posted .*: \([0-9]*\) WR\/s.*/\1/p' "${WORK}/sender.log")"
+echo "[bench] transport=${TRANSPORT} via=${VIA} size=${SIZE_MB}MB replicas=${REPLICAS} time=${ELAPSED_US}us throughput=${MBPS}MB/s post_rate=${POST_RATE:-0}WR/s"
+
+# pacing accuracy: achieved rate (10^6 bytes/s, same unit as the caps) against the tighter cap
+TARGET=""
+for cap in "${RDMA_SIM_RATE_MBPS:-}" "${RDMA_SIM_PEER_RATE_MBPS:-}"; do
+  if [ -n "${cap}" ] && [ "${cap}" != "0" ]; then
+    if [ -z "${TARGET}" ] || awk -v a="${cap}" -v b="${TARGET}" 'BEGIN { exit !(a < b) }'; then TARGET="${cap}"; fi
+  fi
+done
+if [ -n "${TARGET}" ]; then
+  awk -v mb="${SIZE_MB}" -v us="${ELAPSED_US}" -v t="${TARGET}" 'BEGIN {
+    got = mb * 1048576 / 1e6 / (us / 1e6)
+    printf "[bench] pacing target=%.1fMB/s achieved=%.1fMB/s error=%+.1f%%\n", t, got, (got - t) / t * 100
+  }'
+fi
@@ -7,12 +7,24 @@ cd "${SCRIPT_DIR}"
 mkdir -p bin
 
 echo "[build] clean old binaries"
-rm -f bin/sender bin/receiver
+rm -rf bin/sender bin/receiver bin/pacectl bin/librdma_sim.a bin/obj
+
+COMMON_SRC="src/rdma_sim.c src/rdma_xport.c src/rdma_xport_verbs.c src/rdma_xport_shm.c src/rdma_xport_sw.c src/rdma_xport_tcp.c src/rdma_dispatch.c src/rdma_pace.c src/rdma_engine.c"
+
+echo "[build] build librdma_sim.a"
+mkdir -p bin/obj
+for src in ${COMMON_SRC}; do
+  gcc -Wall -O2 -Iinclude -pthread -c -o "bin/obj/$(basename "${src}" .c).o" "${src}"
+done
+ar rcs bin/librdma_sim.a bin/obj/*.o
 
 echo "[build] build sender"
-gcc -Wall -O2 -Iinclude -o bin/sender src/sender.c src/rdma_sim.c -lrdmacm -libverbs
+gcc -Wall -O2 -Iinclude -o bin/sender src/sender.c bin/librdma_sim.a -lrdmacm -libverbs -pthread
 
 echo "[build] build receiver"
-gcc -Wall -O2 -Iinclude -o bin/receiver src/receiver.c src/rdma_sim.c -lrdmacm -libverbs
+gcc -Wall -O2 -Iinclude -o bin/receiver src/receiver.c bin/librdma_sim.a -lrdmacm -libverbs -pthread
+
+echo "[build] build pacectl"
+gcc -Wall -O2 -Iinclude -o bin/pacectl src/pacectl.c src/rdma_pace.c -pthread
 
 echo "[build] done"
@@ -13,11 +13,13 @@
 // - MR：接收端回传 MR 的 addr/rkey/length（发送端据此做 RDMA Write）
 // - FIN：发送端通知“写入结束”
 // - ACK：接收端通知“落盘完成”
+// - BATCH：小文件批量模式，代替 HELLO 描述“一批文件”（数量 + 远端区域总大小）
 typedef enum {
     RDMA_CTRL_HELLO = 1,
     RDMA_CTRL_MR    = 2,
     RDMA_CTRL_FIN   = 3,
-    RDMA_CTRL_ACK   = 4
+    RDMA_CTRL_ACK   = 4,
+    RDMA_CTRL_BATCH = 5
 } rdma_ctrl_type_t;
 
 // 文件名最大长度（只传文件名，不传路径）
@@ -27,6 +29,26 @@ typedef enum {
 // 目的：避免单次 WR 过大导致资源不足，模拟真实系统中需要分块的情况
 #define RDMA_CHUNK (64 * 1024)
 
+// 同时在途的 RDMA Write 数（单文件模式的发送窗口）
+#define RDMA_SEND_WINDOW 8
+
+// QP 发送/接收队列深度（CQ 深度为两者之和）
+// 说明：控制消息与数据写可以同时在途，深度需覆盖发送窗口 + 预投递的 Recv
+#define RDMA_QP_DEPTH 64
+
+// 小文件批量模式参数
+// - RDMA_MAX_SGE：单个 WR 最多聚合的 SGE 数（实际值再与设备 max_sge 取小）
+// - RDMA_BATCH_BYTES：一批文件的数据总量上限（超过则开启下一批）
+// - RDMA_BATCH_MAX_FILES：一批文件的数量上限
+// - RDMA_BATCH_ALIGN：发送端本地缓冲区按页对齐存放每个文件
+#define RDMA_MAX_SGE 32
+#define RDMA_BATCH_BYTES (4 * 1024 * 1024)
+#define RDMA_BATCH_MAX_FILES 1024
+#define RDMA_BATCH_ALIGN 4096
+
+// BATCH 标志位：最后一批（接收端据此结束会话）
+#define RDMA_BATCH_F_LAST 0x1
+
 // HELLO 控制消息：发送端 -> 接收端
 // 说明：接收端收到后根据 file_size 分配接收缓冲区，并注册 MR
 // 注意：所有字段在网络中传输时都按网络字节序
@@ -46,17 +68,52 @@ typedef struct {
 // - addr：接收端 MR 的虚拟地址（对 RDMA 可见）
 // - rkey：接收端 MR 的 rkey（远端访问凭证）
 // - length：接收端 MR 长度
-// 注意：addr/rkey/length 全部按网络字节序
+// - flags：RDMA_MR_F_NOTIFY 等
+// 注意：addr/rkey/length/flags 全部按网络字节序
 // 注意：addr 为接收端虚拟地址，需要配合 rkey 才能访问
 // 在真实系统里这就是“单边写”的关键条件
 typedef struct {
     uint32_t type;
-    uint32_t reserved;
+    uint32_t flags;
     uint64_t addr;
     uint32_t rkey;
     uint64_t length;
 } rdma_ctrl_mr_t;
 
+// MR 标志位：接收端要求每个数据块用 RDMA Write with Imm 写入（imm = 块序号）
+// 链式复制时中继节点据此得知哪些块已落位，立即转发给下一跳
+#define RDMA_MR_F_NOTIFY 0x1
+
+// BATCH 控制消息：发送端 -> 接收端（小文件批量模式）
+// 说明：接收端据此分配一块远端区域（索引 + 数据），随后照常回传 MR
+// - file_count：本批文件数量
+// - total_size：远端区域总大小 = 索引大小 + 所有文件数据
+// - flags：RDMA_BATCH_F_LAST 等
+// - more：超过 RDMA_BATCH_BYTES 的大文件不进批，批量会话结束后逐个另起连接按单文件发送；
+//   最后一批在此声明个数，接收端据此继续接受连接（全是大文件时最后一批为空）
+// 注意：所有字段按网络字节序
+typedef struct {
+    uint32_t type;
+    uint32_t file_count;
+    uint64_t total_size;
+    uint32_t flags;
+    uint32_t more;
+} rdma_ctrl_batch_t;
+
+// 批量区域中的索引项（随数据一起 RDMA Write 到远端区域开头）
+// 远端区域布局：[索引项 * file_count][文件1数据][文件2数据]...（数据紧密排列）
+// - offset：文件数据相对区域起点的偏移
+// - length：文件长度
+// - name_len/name：文件名（只含文件名，不含路径）
+// 注意：所有整数字段按网络字节序
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t name_len;
+    uint32_t reserved;
+    char name[RDMA_MAX_NAME];
+} rdma_batch_entry_t;
+
 // FIN/ACK 控制消息（仅表示状态，没有额外负载）
 typedef struct {
     uint32_t type;
@@ -75,6 +132,11 @@ int rdma_wait_event(struct rdma_event_channel *ec, enum rdma_cm_event_type expec
 // - QP：RC 可靠连接队列对，用于 RDMA 操作
 int rdma_build_qp(struct rdma_cm_id *id, struct ibv_pd **pd, struct ibv_cq **cq, struct ibv_comp_channel **comp_chan);
 
+// 查询 QP 实际可用的发送 SGE 数量
+// 说明：rdma_build_qp 按设备 max_sge（与 RDMA_MAX_SGE 取小）申请，驱动可能再做调整
+// 成功返回 0，并通过 out_max_sge 返回
+int rdma_query_max_sge(struct rdma_cm_id *id, int *out_max_sge);
+
 // 注册 MR
 // access 用于指定访问权限，例如：
 // - IBV_ACCESS_LOCAL_WRITE
@@ -94,9 +156,381 @@ int rdma_post_send(struct rdma_cm_id *id, void *buf, size_t len, struct ibv_mr *
 int rdma_post_write(struct rdma_cm_id *id, void *buf, size_t len, struct ibv_mr *mr,
                     uint64_t remote_addr, uint32_t rkey, uint64_t wr_id);
 
+// Post RDMA Write（多 SGE 聚合写）
+// 说明：把本地多个不连续的缓冲区按顺序“聚合”写入对端一段连续地址
+// 注意：num_sge 不能超过 rdma_query_max_sge 返回的值
+int rdma_post_write_sg(struct rdma_cm_id *id, struct ibv_sge *sge, int num_sge,
+                       uint64_t remote_addr, uint32_t rkey, uint64_t wr_id);
+
+// 批量投递（门铃合并）
+// 每次 ibv_post_send 都要敲一次门铃（RNIC 上是一次 MMIO 写，rxe 上是一次内核通知），
+// 把多个 WR 用 wr.next 串成链一次投递，整条链只敲一次门铃。
+// WR/SGE 模板在 init 时一次填好（opcode、flags、lkey、rkey、sg_list、next），
+// 之后每个块只改 addr / length / remote_addr / wr_id（Write with Imm 还有 imm）
+#define RDMA_POST_BATCH 16
+
+typedef struct {
+    struct ibv_send_wr wr[RDMA_POST_BATCH];
+    struct ibv_sge sge[RDMA_POST_BATCH];
+    int n;                                // 已填的 WR 数
+} rdma_wr_batch_t;
+
+// op：IBV_WR_RDMA_WRITE / IBV_WR_RDMA_WRITE_WITH_IMM
+void rdma_wr_batch_init(rdma_wr_batch_t *b, enum ibv_wr_opcode op, uint32_t lkey, uint32_t rkey);
+
+// 追加一个单 SGE 的 WR，返回追加后的 WR 数；批次已满返回 -1
+// imm 为主机字节序（只对 Write with Imm 有意义）
+int rdma_wr_batch_add(rdma_wr_batch_t *b, uint64_t addr, uint32_t len,
+                      uint64_t remote_addr, uint32_t imm, uint64_t wr_id);
+
+// 一次 ibv_post_send 投递整条链，然后清空批次
+// 返回成功投递的 WR 数：全部成功时等于原 n，出错时为出错 WR 之前的个数
+int rdma_post_wr_batch(struct ibv_qp *qp, rdma_wr_batch_t *b);
+
 // 轮询 CQ 等待完成事件
 // expect 可指定 IBV_WC_SEND / IBV_WC_RECV / IBV_WC_RDMA_WRITE
 // 返回 0 表示等到期望完成；返回 -1 表示失败
+// 注意：非期望类型的完成事件会被丢弃，只适合“一问一答”的严格串行流程；
+// 有多个操作同时在途时请用完成事件分发器（rdma_disp_*）
 int rdma_poll_cq(struct ibv_cq *cq, enum ibv_wc_opcode expect, uint64_t *out_wr_id);
 
+// ===================== 可插拔传输层 =====================
+// 目的：让 sender/receiver 只面对一套“类 verbs”接口，底下可以换不同后端
+// - RDMA_XPORT_VERBS：真实 rdma-core（RNIC 或 Soft-RoCE）
+// - RDMA_XPORT_SHM：进程间共享内存模拟（无需 RDMA 设备，用于 CI/基准测试）
+// - RDMA_XPORT_TCP：TCP 回退（无 RDMA 设备的主机），数据面 sendfile/splice 零拷贝 + 多路并行流
+// 约定：
+// - 完成事件直接复用 struct ibv_wc（opcode/status/wr_id/byte_len/imm_data）
+// - SGE 直接复用 struct ibv_sge（lkey 取自 rdma_mem_t）
+// - 访问权限直接复用 IBV_ACCESS_*
+// 后端通过环境变量 RDMA_SIM_TRANSPORT 选择（verbs / shm / tcp / auto），默认 auto：
+// - 发送端：对端在本机（回环或本机网卡地址）且本机有 shm 监听时走 shm，
+//   否则优先 verbs，设备不可用时回退 tcp
+// - 接收端：在所有可用后端上同时监听，谁先连上用谁
+typedef enum {
+    RDMA_XPORT_VERBS = 0,
+    RDMA_XPORT_SHM   = 1,
+    RDMA_XPORT_TCP   = 2,
+    RDMA_XPORT_AUTO  = 3                  // 仅用于选择，端点的实际类型见 rdma_ep_kind
+} rdma_xport_kind_t;
+
+// TCP 后端并行数据流数量（环境变量 RDMA_SIM_TCP_STREAMS 可调）
+#define RDMA_TCP_STREAMS 4
+#define RDMA_TCP_MAX_STREAMS 16
+
+// 连接端点（QP + CQ + PD 的抽象），具体结构由后端定义
+typedef struct rdma_ep rdma_ep_t;
+
+// 监听端点（接收端用）
+typedef struct rdma_listener rdma_listener_t;
+
+// 注册内存（MR 的抽象）
+// - addr/length：内存范围
+// - lkey/rkey：本地/远端访问凭证（含义与 verbs 相同）
+// - priv：后端私有数据（verbs 下为 struct ibv_mr *）
+// - owned：由 rdma_mem_alloc 分配，注销时一并释放
+// - fd/flags：文件型内存（rdma_mem_reg_file / rdma_mem_alloc_file）
+typedef struct {
+    void *addr;
+    size_t length;
+    uint32_t lkey;
+    uint32_t rkey;
+    void *priv;
+    int owned;
+    int fd;
+    int flags;
+} rdma_mem_t;
+
+// rdma_mem_t.flags
+#define RDMA_MEM_F_MAPPED   0x1           // addr 是文件映射，注销时 munmap
+#define RDMA_MEM_F_FILE_DST 0x2           // 目的文件：rdma_mem_flush 时数据须落到 fd
+#define RDMA_MEM_F_DIRECT   0x4           // 后端已把数据直接落到 fd，flush 无需再写
+
+// 从环境变量 RDMA_SIM_TRANSPORT 解析后端类型
+// 未设置时返回 RDMA_XPORT_AUTO；取值非法返回 -1
+int rdma_xport_from_env(rdma_xport_kind_t *out_kind);
+
+// 后端名称（日志用）
+const char *rdma_xport_name(rdma_xport_kind_t kind);
+
+// 发送端：解析地址并创建端点（此时 QP 已可用，可先注册内存 / post_recv）
+// AUTO：逐个后端“创建 + 建连”，连上才返回（对端拒绝或不可达时换下一个后端）
+int rdma_ep_create(rdma_xport_kind_t kind, const char *ip, const char *port, rdma_ep_t **out_ep);
+
+// 发送端：发起连接，等待建立完成（AUTO 端点已建连，直接返回 0）
+int rdma_ep_connect(rdma_ep_t *ep);
+
+// 接收端：在 ip:port 上监听
+int rdma_listener_create(rdma_xport_kind_t kind, const char *ip, const char *port, rdma_listener_t **out_ln);
+
+// 接收端：等待一个连接请求，返回对应端点（QP 已可用，尚未 accept）
+int rdma_listener_get_request(rdma_listener_t *ln, rdma_ep_t **out_ep);
+
+// 接收端：接受连接，等待建立完成
+int rdma_ep_accept(rdma_ep_t *ep);
+
+// 关闭监听端点
+void rdma_listener_close(rdma_listener_t *ln);
+
+// 断开连接并释放端点
+void rdma_ep_close(rdma_ep_t *ep);
+
+// 单个 WR 可携带的最大 SGE 数
+int rdma_ep_max_sge(rdma_ep_t *ep);
+
+// 端点实际使用的后端（AUTO 选择后的结果）
+rdma_xport_kind_t rdma_ep_kind(rdma_ep_t *ep);
+
+// 注册已有内存
+// 注意：需要远端访问（REMOTE_WRITE/REMOTE_READ）的内存请用 rdma_mem_alloc，
+// 共享内存后端只能把自己分配的内存暴露给对端
+int rdma_mem_reg(rdma_ep_t *ep, void *buf, size_t len, int access, rdma_mem_t *out_mem);
+
+// 分配并注册内存（可被远端访问）
+int rdma_mem_alloc(rdma_ep_t *ep, size_t len, int access, rdma_mem_t *out_mem);
+
+// 注销内存（rdma_mem_alloc 分配的内存同时释放）
+void rdma_mem_dereg(rdma_ep_t *ep, rdma_mem_t *mem);
+
+// 注册源文件（只读，作为 RDMA Write 的本地源）
+// 说明：文件被映射而不是读入内存；tcp 后端发送时直接 sendfile，不经过用户态
+// access 通常传 0（Write 的源不需要本地写权限）
+int rdma_mem_reg_file(rdma_ep_t *ep, int fd, size_t len, int access, rdma_mem_t *out_mem);
+
+// 分配以目的文件为落点的内存（远端写入的数据最终进入 fd）
+// 说明：fd 需可读写，会被截断/扩展到 len；tcp 后端直接 splice 进文件，
+// 其他后端写入内存，由 rdma_mem_flush 落盘
+int rdma_mem_alloc_file(rdma_ep_t *ep, int fd, size_t len, int access, rdma_mem_t *out_mem);
+
+// 确保目的文件内容完整（收到 FIN 之后调用）
+int rdma_mem_flush(rdma_ep_t *ep, rdma_mem_t *mem);
+
+// Post Recv / Send（控制面）
+int rdma_ep_post_recv(rdma_ep_t *ep, void *buf, size_t len, rdma_mem_t *mem, uint64_t wr_id);
+int rdma_ep_post_send(rdma_ep_t *ep, void *buf, size_t len, rdma_mem_t *mem, uint64_t wr_id);
+
+// RDMA Write（可多 SGE 聚合）
+int rdma_ep_post_write(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge,
+                       uint64_t remote_addr, uint32_t rkey, uint64_t wr_id);
+
+// RDMA Write with Immediate：写入数据的同时消耗对端一个 Recv，
+// 对端 CQ 收到 IBV_WC_RECV_RDMA_WITH_IMM（imm_data 为主机字节序传入）
+int rdma_ep_post_write_imm(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge,
+                           uint64_t remote_addr, uint32_t rkey, uint32_t imm, uint64_t wr_id);
+
+// RDMA Read：把对端内存读到本地 SGE
+int rdma_ep_post_read(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge,
+                      uint64_t remote_addr, uint32_t rkey, uint64_t wr_id);
+
+// 批量投递 Write / Write with Imm（rdma_wr_batch_t 见上文）
+// verbs 整条链一次 ibv_post_send；tcp 整批只唤醒一次各数据流的发送线程；其余后端逐个投递
+// 返回成功投递的 WR 数（出错时小于 b->n），批次随后被清空
+int rdma_ep_post_batch(rdma_ep_t *ep, rdma_wr_batch_t *b);
+
+// 非阻塞轮询：最多取 max 个完成事件，返回个数（0 表示暂无），出错返回 -1
+int rdma_ep_poll(rdma_ep_t *ep, struct ibv_wc *wc, int max);
+
+// ===================== 完成事件分发器 =====================
+// 一个端点的 Send/Recv/Write 共用一个 CQ。按 opcode 挑选完成事件会丢掉别的操作的事件，
+// 迫使调用方严格串行。分发器按 wr_id 把每个完成事件投递给对应的请求：
+// - 每次 poll 成批取回（RDMA_DISP_BATCH 个）
+// - wr_id 由分发器分配（槽位下标 + 代数），过期或未登记的 wr_id 会被识别出来
+// - 请求完成后填写 done/wc，并调用回调（若有）；错误完成事件会打印状态
+// 用法：rdma_disp_post_* 代替 rdma_ep_post_*，再用 rdma_disp_wait 等某个请求，
+// 或用 rdma_disp_poll 推进、在回调里处理
+// 注意：请求结构在完成前必须保持有效（一般放在调用方栈上或控制结构里）
+
+#define RDMA_DISP_SLOTS 256               // 同时在途的请求上限
+#define RDMA_DISP_BATCH 16                // 单次 poll 最多取回的完成事件数
+#define RDMA_DISP_SPIN 64                 // 连续空轮询多少次后开始小睡
+
+typedef struct rdma_req rdma_req_t;
+
+// 完成回调：在调用 rdma_disp_poll / rdma_disp_wait 的线程里执行
+typedef void (*rdma_req_cb_t)(rdma_req_t *req, const struct ibv_wc *wc);
+
+// 一次在途操作
+// - cb/arg：调用方填写（cb 可为 NULL）
+// - wr_id：登记时由分发器分配
+// - done/wc：完成后由分发器填写
+struct rdma_req {
+    rdma_req_cb_t cb;
+    void *arg;
+    uint64_t wr_id;
+    int done;
+    struct ibv_wc wc;
+};
+
+typedef struct {
+    rdma_ep_t *ep;
+    rdma_req_t *slot[RDMA_DISP_SLOTS];    // 在途请求
+    uint32_t gen[RDMA_DISP_SLOTS];        // 槽位代数，每次复用加一
+    uint32_t next;                        // 下次分配槽位的起点
+    int outstanding;                      // 在途请求数
+    int failed;                           // 出现过错误完成事件
+    uint64_t polls;                       // 统计：poll 次数 / 取回的完成事件数 / 未登记事件数
+    uint64_t wcs;
+    uint64_t stray;
+} rdma_disp_t;
+
+void rdma_disp_init(rdma_disp_t *d, rdma_ep_t *ep);
+
+// 登记请求并返回分配的 wr_id（槽位用尽返回 0）；投递失败时用 rdma_disp_untrack 撤销
+uint64_t rdma_disp_track(rdma_disp_t *d, rdma_req_t *req);
+void rdma_disp_untrack(rdma_disp_t *d, uint64_t wr_id);
+
+// 登记 + 投递
+int rdma_disp_post_recv(rdma_disp_t *d, rdma_req_t *req, void *buf, size_t len, rdma_mem_t *mem);
+int rdma_disp_post_send(rdma_disp_t *d, rdma_req_t *req, void *buf, size_t len, rdma_mem_t *mem);
+int rdma_disp_post_write(rdma_disp_t *d, rdma_req_t *req, struct ibv_sge *sge, int num_sge,
+                         uint64_t remote_addr, uint32_t rkey);
+int rdma_disp_post_write_imm(rdma_disp_t *d, rdma_req_t *req, struct ibv_sge *sge, int num_sge,
+                             uint64_t remote_addr, uint32_t rkey, uint32_t imm);
+// 批量：reqs[i] 对应 b->wr[i]（wr_id 由这里改写）；全部投递成功返回 0，
+// 否则未投递的请求撤销登记并返回 -1（已投递的照常完成）
+int rdma_disp_post_batch(rdma_disp_t *d, rdma_wr_batch_t *b, rdma_req_t *const *reqs);
+
+// 非阻塞：成批取回并分发，返回分发的事件数，端点出错返回 -1
+int rdma_disp_poll(rdma_disp_t *d);
+
+// 阻塞等待某个请求完成；完成状态为成功返回 0，否则 -1
+int rdma_disp_wait(rdma_disp_t *d, rdma_req_t *req);
+
+// 阻塞等待所有在途请求完成；全部成功返回 0
+int rdma_disp_drain(rdma_disp_t *d);
+
+// ===================== QoS：限速与优先级 =====================
+// 发送端投递每个数据 Write 前先向 pacer 申请令牌（GCRA 形式的令牌桶，按字节计）：
+// - 单传输限速：本次传输自己的速率上限
+// - 对端限速：本机发往同一对端的所有传输共享一个桶，
+//   状态放在共享内存 /dev/shm/rdma_sim.pace.<peer>，多个 sender 进程之间也生效
+// - 优先级：HIGH > NORMAL > BULK；更高优先级的传输最近在发数据时，低优先级的块先让路，
+//   高优先级的块因此插到批量传输的块前面
+// 速率上限保存在共享内存里，每个块都重新读取，可用 bin/pacectl 在运行时调整
+// 环境变量（sender）：RDMA_SIM_RATE_MBPS（单传输）、RDMA_SIM_PEER_RATE_MBPS（对端）、
+// RDMA_SIM_PRIO（high / normal / bulk，默认 normal）；速率单位 MB/s（10^6 字节），0 表示不限
+
+enum {
+    RDMA_PRIO_HIGH   = 0,
+    RDMA_PRIO_NORMAL = 1,
+    RDMA_PRIO_BULK   = 2,
+    RDMA_PRIO_CLASSES
+};
+
+#define RDMA_PACE_SLOTS 64                // 每个对端同时登记的传输数上限
+#define RDMA_PACE_BURST_NS 1000000ull     // 桶深：1ms 的流量（至少容纳一个块）
+#define RDMA_PACE_ACTIVE_NS 2000000ull    // 某优先级 2ms 内取过令牌即视为在发送
+#define RDMA_PACE_YIELD_US 200            // 让路时每次小睡的时长
+
+// 一个传输在对端共享状态里的登记项
+typedef struct {
+    int32_t pid;                          // 0 表示空闲（进程退出后由后来者回收）
+    uint32_t prio;
+    uint64_t rate_bps;                    // 单传输上限（字节/秒，0 不限），pacectl 可改
+    uint64_t sent_bytes;                  // 统计：已放行字节数
+} rdma_pace_slot_t;
+
+// 对端共享状态（映射自 /dev/shm，所有字段原子读写）
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rate_bps;                    // 对端总上限（字节/秒，0 不限），pacectl 可改
+    uint64_t tat_ns;                      // 对端桶的“理论到达时间”（CLOCK_MONOTONIC）
+    uint64_t active_ns[RDMA_PRIO_CLASSES];    // 各优先级最近一次取令牌的时间
+    rdma_pace_slot_t slot[RDMA_PACE_SLOTS];
+} rdma_pace_peer_t;
+
+typedef struct {
+    rdma_pace_peer_t *peer;               // 对端共享状态（打开失败时为 NULL，只做单传输限速）
+    rdma_pace_slot_t *slot;               // 本传输的登记项（peer 为 NULL 或槽位已满时指向 local）
+    rdma_pace_slot_t local;
+    int prio;
+    uint64_t tat_ns;                      // 单传输桶的理论到达时间
+    uint64_t waited_ns;                   // 统计：因限速 / 让路而等待的总时长
+} rdma_pacer_t;
+
+// 打开（必要时创建）对端共享状态；pacectl 也用它
+int rdma_pace_peer_open(const char *peer, rdma_pace_peer_t **out_peer);
+void rdma_pace_peer_close(rdma_pace_peer_t *peer);
+
+// 按环境变量初始化本传输的 pacer（未配置限速与优先级时也可用，取令牌立即返回）
+int rdma_pacer_open(rdma_pacer_t *p, const char *peer);
+
+// 申请 bytes 字节的令牌：按优先级让路、单传输限速、对端限速，必要时睡眠
+void rdma_pacer_take(rdma_pacer_t *p, size_t bytes);
+
+// 非阻塞版本（给同时推进多个传输的进度线程用）：
+// 现在就能发送时取走令牌并返回 0；否则不取令牌，返回建议等待的纳秒数
+uint64_t rdma_pacer_try(rdma_pacer_t *p, size_t bytes);
+
+void rdma_pacer_close(rdma_pacer_t *p);
+
+// "high" / "normal" / "bulk" -> RDMA_PRIO_*；非法返回 -1
+int rdma_pace_prio_from_name(const char *name);
+const char *rdma_pace_prio_name(int prio);
+
+// ===================== 异步传输引擎（库接口） =====================
+// 让应用在进程内直接发送文件 / 内存，而不必 fork/exec sender：
+// - 应用线程提交传输，立即拿到句柄；之后可以查询、等待，或在完成回调里处理
+// - 提交走无锁 MPSC 队列（Vyukov 链表队列）：任意多个线程同时提交，热路径上不加锁
+// - 建连线程取出新传输，每个传输在自己的连接线程里建连，连上后经第二个 MPSC 队列交给进度线程
+// - 一个进度线程独占已建连的端点（QP/CQ）：推进每个传输的状态机、轮询完成事件
+// - 协议与 sender 相同（HELLO -> MR -> 分块 Write -> FIN -> ACK），对端就是普通的 receiver
+// 说明：
+// - 建连（地址解析、连接建立）不在进度线程里：慢的或连不上的对端不影响其他传输
+// - 后端、限速、优先级、批量投递与 sender 一样取自环境变量（RDMA_SIM_TRANSPORT 等）
+// - 源文件 / 缓冲区在传输完成前必须保持不变
+// 链接：librdma_sim.a（make 生成在 bin/ 下），再加 -lrdmacm -libverbs -pthread
+
+typedef struct rdma_engine rdma_engine_t;
+typedef struct rdma_xfer rdma_xfer_t;
+
+// 完成回调：在进度线程里执行，不要在回调里阻塞；status 为 0 表示成功
+// 回调返回前句柄一直有效（回调里可以调用 rdma_xfer_release）
+typedef void (*rdma_xfer_cb_t)(rdma_xfer_t *x, int status, void *arg);
+
+// 完成后的统计
+// - kind：实际使用的后端
+// - wrs / post_calls / post_ns：数据 Write 个数、投递调用次数、花在投递调用里的时间
+// - paced_ns：因限速 / 让路而推迟的总时长
+// - elapsed_ns：从提交到完成
+typedef struct {
+    rdma_xport_kind_t kind;
+    uint64_t bytes;
+    uint32_t wrs;
+    uint64_t post_calls;
+    uint64_t post_ns;
+    uint64_t paced_ns;
+    uint64_t elapsed_ns;
+} rdma_xfer_stats_t;
+
+// 创建引擎并启动建连线程、进度线程
+int rdma_engine_create(rdma_engine_t **out_e);
+
+// 等已提交的传输全部结束，停止建连线程、进度线程并释放引擎
+// 之后不能再提交；未释放的句柄仍可查询，需各自 rdma_xfer_release
+void rdma_engine_destroy(rdma_engine_t *e);
+
+// 提交文件传输（对端保存为 path 的文件名）
+// 文件在这里打开并校验，失败直接返回 -1；cb 可为 NULL
+int rdma_xfer_submit_file(rdma_engine_t *e, const char *ip, const char *port, const char *path,
+                          rdma_xfer_cb_t cb, void *arg, rdma_xfer_t **out_x);
+
+// 提交内存传输（对端保存为 name）
+int rdma_xfer_submit_buf(rdma_engine_t *e, const char *ip, const char *port, const void *buf,
+                         size_t len, const char *name, rdma_xfer_cb_t cb, void *arg,
+                         rdma_xfer_t **out_x);
+
+// 非阻塞查询：已完成返回 1，仍在进行返回 0
+int rdma_xfer_test(rdma_xfer_t *x);
+
+// 阻塞等待完成；成功返回 0，失败返回 -1
+int rdma_xfer_wait(rdma_xfer_t *x);
+
+// 完成后取统计（未完成返回 -1）
+int rdma_xfer_stats(rdma_xfer_t *x, rdma_xfer_stats_t *out);
+
+// 放弃句柄：可以在完成前调用（只靠回调得知结果），传输照常进行，结束后自动释放
+void rdma_xfer_release(rdma_xfer_t *x);
+
 #endif // RDMA_SIM_H
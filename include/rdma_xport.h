@@ -0,0 +1,182 @@
+﻿#ifndef RDMA_XPORT_H
+#define RDMA_XPORT_H
+
+#include "rdma_sim.h"
+
+#include <pthread.h>
+
+// 传输后端接口（仅供 rdma_xport*.c 内部使用）
+// 每个后端提供一张操作表，rdma_xport.c 负责按 kind 分发
+// 端点/监听端点的通用部分定义在这里，后端私有状态挂在 priv 上
+
+typedef struct rdma_xport_ops rdma_xport_ops_t;
+
+struct rdma_ep {
+    const rdma_xport_ops_t *ops;          // 后端操作表
+    rdma_xport_kind_t kind;               // 后端类型
+    int max_sge;                          // 单个 WR 最大 SGE 数（由后端填写）
+    int connected;                        // 已建连（AUTO 在 create 中就建好）
+    void *priv;                           // 后端私有状态
+};
+
+struct rdma_listener {
+    const rdma_xport_ops_t *ops;
+    rdma_xport_kind_t kind;
+    void *priv;
+    rdma_listener_t *subs[RDMA_XPORT_AUTO];   // AUTO：各后端的子监听端点
+    int nsubs;
+};
+
+struct rdma_xport_ops {
+    const char *name;
+
+    // 建连（发送端）
+    int (*create)(rdma_ep_t *ep, const char *ip, const char *port);
+    int (*connect)(rdma_ep_t *ep);
+
+    // 建连（接收端）
+    int (*listen)(rdma_listener_t *ln, const char *ip, const char *port);
+    int (*get_request)(rdma_listener_t *ln, rdma_ep_t *ep);
+    int (*accept)(rdma_ep_t *ep);
+    void (*close_listener)(rdma_listener_t *ln);
+    int (*listen_fd)(rdma_listener_t *ln);   // 有连接请求时可读（AUTO 多路监听用）
+
+    // 内存注册
+    int (*mem_reg)(rdma_ep_t *ep, void *buf, size_t len, int access, rdma_mem_t *mem);
+    int (*mem_alloc)(rdma_ep_t *ep, size_t len, int access, rdma_mem_t *mem);
+    void (*mem_dereg)(rdma_ep_t *ep, rdma_mem_t *mem);
+    // 可选：文件型内存。为 NULL 时由 rdma_xport.c 用映射 / 普通内存 + pwrite 实现
+    int (*mem_reg_file)(rdma_ep_t *ep, int fd, void *map, size_t len, int access, rdma_mem_t *mem);
+    int (*mem_alloc_file)(rdma_ep_t *ep, int fd, size_t len, int access, rdma_mem_t *mem);
+
+    // 数据/控制面
+    int (*post_recv)(rdma_ep_t *ep, struct ibv_sge *sge, uint64_t wr_id);
+    int (*post_send)(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge, uint64_t wr_id);
+    // op：IBV_WR_RDMA_WRITE / IBV_WR_RDMA_WRITE_WITH_IMM / IBV_WR_RDMA_READ
+    int (*post_rdma)(rdma_ep_t *ep, enum ibv_wr_opcode op, struct ibv_sge *sge, int num_sge,
+                     uint64_t remote_addr, uint32_t rkey, uint32_t imm, uint64_t wr_id);
+    // 可选：一次投递整条 WR 链，返回成功投递的个数。为 NULL 时由 rdma_xport.c 逐个 post_rdma
+    int (*post_batch)(rdma_ep_t *ep, rdma_wr_batch_t *b);
+    int (*poll)(rdma_ep_t *ep, struct ibv_wc *wc, int max);
+
+    // 断开并释放后端状态（ep 本身由 rdma_xport.c 释放）
+    void (*close)(rdma_ep_t *ep);
+};
+
+// ===================== 软件 QP（shm / tcp 后端共用） =====================
+// 没有网卡帮忙时，由软件维护 Recv 队列、CQ 和本地 MR 表
+// 控制面消息（Send、Write with Imm 通知、MR 导出）走端点的连接套接字，格式为 sw_msg_t + 负载
+
+#define SW_CQ_DEPTH 1024                  // CQ 深度
+#define SW_RQ_DEPTH 256                   // Recv 队列 / 未匹配消息队列深度
+#define SW_MAX_SEND (64 * 1024)           // 单条 Send 最大负载
+#define SW_FENCE_LANES RDMA_TCP_MAX_STREAMS   // fence 按数据流分道计数
+
+enum {
+    SW_MSG_SEND      = 1,                 // 双边 Send（带负载）
+    SW_MSG_WRITE_IMM = 2,                 // Write with Imm 的通知（数据另行写入）
+    SW_MSG_MR        = 3,                 // 导出 MR（shm：附带 memfd）
+    SW_MSG_DEREG     = 4                  // 撤销 MR
+};
+
+// 控制面消息头
+typedef struct {
+    uint32_t type;
+    uint32_t len;                         // SEND：负载长度；WRITE_IMM：写入字节数
+    uint32_t imm;                         // WRITE_IMM：立即数（主机字节序）
+    uint32_t rkey;                        // MR/DEREG：rkey
+    uint64_t addr;                        // MR：导出方的虚拟地址
+    uint64_t length;                      // MR：长度
+    uint32_t access;                      // MR：访问权限
+    uint32_t reserved;
+    uint64_t ready_ns;                    // 对端完成事件最早可见时间（CLOCK_MONOTONIC，0 表示立即）
+    uint64_t fence[SW_FENCE_LANES];       // 发送本消息前每条数据流已投递的字节数（对端落位后才交付）
+} sw_msg_t;
+
+// 本地注册的内存
+typedef struct {
+    uint32_t key;                         // lkey == rkey
+    uint8_t *addr;
+    size_t len;
+    int access;
+    int fd;                               // 背后的文件/memfd（无则为 -1）
+    int file_dst;                         // 目的文件：数据直接落到 fd（而不是 addr）
+    int exported;                         // 是否已导出给对端
+} sw_mr_t;
+
+typedef struct {
+    uint64_t wr_id;
+    uint8_t *addr;
+    uint32_t len;
+} sw_recv_t;
+
+// 到达时尚无 Recv 可用（或数据尚未落位）的消息
+typedef struct {
+    sw_msg_t hdr;
+    uint8_t *payload;
+} sw_pending_t;
+
+typedef struct {
+    struct ibv_wc wc;
+    uint64_t ready_ns;
+} sw_cqe_t;
+
+typedef struct sw_qp sw_qp_t;
+
+struct sw_qp {
+    int sock;                             // 控制面连接
+    int connected;
+    int peer_closed;
+    int error;                            // 后端内部线程出错（poll 返回 -1）
+
+    pthread_mutex_t cq_lock;              // CQ 可能被后端数据线程写入
+    sw_cqe_t cq[SW_CQ_DEPTH];
+    unsigned cq_head, cq_tail;
+
+    sw_recv_t rq[SW_RQ_DEPTH];
+    unsigned rq_head, rq_tail;
+    sw_pending_t pend[SW_RQ_DEPTH];
+    unsigned pend_head, pend_tail;
+
+    uint64_t placed_bytes[SW_FENCE_LANES];    // 每条数据流已落位的字节（原子读写，对应 sw_msg_t.fence）
+
+    pthread_mutex_t mr_lock;              // 保护 MR 表（数据线程会查表）
+    sw_mr_t *mrs;
+    int nmrs;
+    int cap_mrs;
+    uint32_t next_key;
+
+    // 处理 SEND / WRITE_IMM 以外的消息（可为 NULL）；fd 为随消息附带的描述符
+    int (*on_msg)(sw_qp_t *q, const sw_msg_t *hdr, int fd);
+    void *ctx;                            // on_msg 使用的后端上下文
+};
+
+int sw_qp_init(sw_qp_t *q);
+void sw_qp_destroy(sw_qp_t *q);
+
+// MR 表
+sw_mr_t *sw_mr_add(sw_qp_t *q, uint8_t *addr, size_t len, int access, int fd);
+int sw_mr_lookup(sw_qp_t *q, uint32_t key, sw_mr_t *out);   // 拷贝一份，线程安全
+void sw_mr_del(sw_qp_t *q, uint32_t key);
+void sw_fill_mem(rdma_mem_t *mem, const sw_mr_t *mr);
+int sw_check_sges(sw_qp_t *q, const struct ibv_sge *sge, int num_sge, uint64_t *out_total);
+
+// CQ / 消息
+int sw_cq_push(sw_qp_t *q, uint64_t wr_id, enum ibv_wc_opcode op, enum ibv_wc_status status,
+               uint32_t byte_len, uint32_t imm, int with_imm, uint64_t ready_ns);
+int sw_send_msg(sw_qp_t *q, const sw_msg_t *hdr, const void *payload, size_t len, int fd);
+int sw_read_full(int fd, void *buf, size_t len);
+int sw_progress(sw_qp_t *q);
+
+// verbs 语义的软件实现
+int sw_post_recv(sw_qp_t *q, struct ibv_sge *sge, uint64_t wr_id);
+int sw_post_send(sw_qp_t *q, struct ibv_sge *sge, int num_sge, uint64_t wr_id,
+                 uint64_t ready_ns, const uint64_t *fence);
+int sw_send_imm(sw_qp_t *q, uint32_t len, uint32_t imm, uint64_t ready_ns, const uint64_t *fence);
+int sw_poll(sw_qp_t *q, struct ibv_wc *wc, int max);
+
+extern const rdma_xport_ops_t rdma_xport_verbs_ops;
+extern const rdma_xport_ops_t rdma_xport_shm_ops;
+extern const rdma_xport_ops_t rdma_xport_tcp_ops;
+
+#endif // RDMA_XPORT_H
@@ -0,0 +1,67 @@
+﻿#include "rdma_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+
+// 运行时查看 / 调整 QoS 限速
+// - pacectl <peer_ip>                      列出对端上限与正在发送的传输
+// - pacectl <peer_ip> peer <mbps>          设置对端总上限（0 不限）
+// - pacectl <peer_ip> pid <pid> <mbps>     设置某个传输（sender 进程）的上限（0 不限）
+// 修改立即生效：sender 每发一个块都会重新读取上限
+
+static void show(const char *peer_ip, rdma_pace_peer_t *peer) {
+    uint64_t rate = __atomic_load_n(&peer->rate_bps, __ATOMIC_ACQUIRE);
+    printf("peer %s: rate=%.1fMB/s\n", peer_ip, (double)rate / 1e6);
+    for (int i = 0; i < RDMA_PACE_SLOTS; i++) {
+        rdma_pace_slot_t *s = &peer->slot[i];
+        int32_t pid = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE);
+        if (pid == 0 || (kill(pid, 0) != 0 && errno == ESRCH)) {
+            continue;
+        }
+        printf("  pid=%d prio=%s rate=%.1fMB/s sent=%.1fMB\n", (int)pid,
+               rdma_pace_prio_name((int)__atomic_load_n(&s->prio, __ATOMIC_RELAXED)),
+               (double)__atomic_load_n(&s->rate_bps, __ATOMIC_RELAXED) / 1e6,
+               (double)__atomic_load_n(&s->sent_bytes, __ATOMIC_RELAXED) / 1e6);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 4 && argc != 5) {
+        fprintf(stderr, "Usage: %s <peer_ip> [peer <mbps> | pid <pid> <mbps>]\n", argv[0]);
+        return 1;
+    }
+    rdma_pace_peer_t *peer = NULL;
+    if (rdma_pace_peer_open(argv[1], &peer) != 0) {
+        return 1;
+    }
+
+    int rc = 0;
+    if (argc == 4 && strcmp(argv[2], "peer") == 0) {
+        uint64_t bps = (uint64_t)(atof(argv[3]) * 1e6);
+        __atomic_store_n(&peer->rate_bps, bps, __ATOMIC_RELEASE);
+    } else if (argc == 5 && strcmp(argv[2], "pid") == 0) {
+        int32_t pid = (int32_t)atoi(argv[3]);
+        uint64_t bps = (uint64_t)(atof(argv[4]) * 1e6);
+        rc = 1;
+        for (int i = 0; i < RDMA_PACE_SLOTS; i++) {
+            if (pid > 0 && __atomic_load_n(&peer->slot[i].pid, __ATOMIC_ACQUIRE) == pid) {
+                __atomic_store_n(&peer->slot[i].rate_bps, bps, __ATOMIC_RELEASE);
+                rc = 0;
+            }
+        }
+        if (rc != 0) {
+            fprintf(stderr, "no transfer with pid %s to %s\n", argv[3], argv[1]);
+        }
+    } else if (argc != 2) {
+        fprintf(stderr, "Usage: %s <peer_ip> [peer <mbps> | pid <pid> <mbps>]\n", argv[0]);
+        rc = 1;
+    }
+    if (rc == 0) {
+        show(argv[1], peer);
+    }
+    rdma_pace_peer_close(peer);
+    return rc;
+}
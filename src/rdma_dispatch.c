@@ -0,0 +1,194 @@
+﻿#include "rdma_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+// 完成事件分发器
+// wr_id 编码：高 32 位为槽位代数（从 1 开始，保证 wr_id 非 0），低 32 位为槽位下标
+// 槽位释放后代数加一，迟到的、重复的 wr_id 不会误投递给新请求
+
+static uint64_t make_wr_id(uint32_t gen, uint32_t idx) {
+    return ((uint64_t)gen << 32) | idx;
+}
+
+void rdma_disp_init(rdma_disp_t *d, rdma_ep_t *ep) {
+    memset(d, 0, sizeof(*d));
+    d->ep = ep;
+    for (int i = 0; i < RDMA_DISP_SLOTS; i++) {
+        d->gen[i] = 1;
+    }
+}
+
+uint64_t rdma_disp_track(rdma_disp_t *d, rdma_req_t *req) {
+    if (d->outstanding == RDMA_DISP_SLOTS) {
+        fprintf(stderr, "dispatcher: too many outstanding requests\n");
+        return 0;
+    }
+    // 从上次的位置往后找空槽，避免刚释放的槽位立即复用
+    uint32_t idx = d->next;
+    while (d->slot[idx]) {
+        idx = (idx + 1) % RDMA_DISP_SLOTS;
+    }
+    d->next = (idx + 1) % RDMA_DISP_SLOTS;
+    d->slot[idx] = req;
+    d->outstanding++;
+    req->done = 0;
+    req->wr_id = make_wr_id(d->gen[idx], idx);
+    memset(&req->wc, 0, sizeof(req->wc));
+    return req->wr_id;
+}
+
+// 按 wr_id 找回并释放槽位；wr_id 无效返回 NULL
+static rdma_req_t *take(rdma_disp_t *d, uint64_t wr_id) {
+    uint32_t idx = (uint32_t)wr_id;
+    uint32_t gen = (uint32_t)(wr_id >> 32);
+    if (idx >= RDMA_DISP_SLOTS || d->gen[idx] != gen || !d->slot[idx]) {
+        return NULL;
+    }
+    rdma_req_t *req = d->slot[idx];
+    d->slot[idx] = NULL;
+    d->gen[idx]++;
+    if (d->gen[idx] == 0) {
+        d->gen[idx] = 1;
+    }
+    d->outstanding--;
+    return req;
+}
+
+void rdma_disp_untrack(rdma_disp_t *d, uint64_t wr_id) {
+    take(d, wr_id);
+}
+
+int rdma_disp_post_recv(rdma_disp_t *d, rdma_req_t *req, void *buf, size_t len, rdma_mem_t *mem) {
+    uint64_t wr_id = rdma_disp_track(d, req);
+    if (!wr_id || rdma_ep_post_recv(d->ep, buf, len, mem, wr_id) != 0) {
+        rdma_disp_untrack(d, wr_id);
+        return -1;
+    }
+    return 0;
+}
+
+int rdma_disp_post_send(rdma_disp_t *d, rdma_req_t *req, void *buf, size_t len, rdma_mem_t *mem) {
+    uint64_t wr_id = rdma_disp_track(d, req);
+    if (!wr_id || rdma_ep_post_send(d->ep, buf, len, mem, wr_id) != 0) {
+        rdma_disp_untrack(d, wr_id);
+        return -1;
+    }
+    return 0;
+}
+
+int rdma_disp_post_write(rdma_disp_t *d, rdma_req_t *req, struct ibv_sge *sge, int num_sge,
+                         uint64_t remote_addr, uint32_t rkey) {
+    uint64_t wr_id = rdma_disp_track(d, req);
+    if (!wr_id || rdma_ep_post_write(d->ep, sge, num_sge, remote_addr, rkey, wr_id) != 0) {
+        rdma_disp_untrack(d, wr_id);
+        return -1;
+    }
+    return 0;
+}
+
+int rdma_disp_post_write_imm(rdma_disp_t *d, rdma_req_t *req, struct ibv_sge *sge, int num_sge,
+                             uint64_t remote_addr, uint32_t rkey, uint32_t imm) {
+    uint64_t wr_id = rdma_disp_track(d, req);
+    if (!wr_id ||
+        rdma_ep_post_write_imm(d->ep, sge, num_sge, remote_addr, rkey, imm, wr_id) != 0) {
+        rdma_disp_untrack(d, wr_id);
+        return -1;
+    }
+    return 0;
+}
+
+int rdma_disp_post_batch(rdma_disp_t *d, rdma_wr_batch_t *b, rdma_req_t *const *reqs) {
+    int n = b->n;
+    for (int i = 0; i < n; i++) {
+        b->wr[i].wr_id = rdma_disp_track(d, reqs[i]);
+        if (!b->wr[i].wr_id) {
+            for (int j = 0; j < i; j++) {
+                rdma_disp_untrack(d, b->wr[j].wr_id);
+            }
+            b->n = 0;
+            return -1;
+        }
+    }
+    int posted = rdma_ep_post_batch(d->ep, b);
+    for (int i = posted < 0 ? 0 : posted; i < n; i++) {
+        rdma_disp_untrack(d, reqs[i]->wr_id);               // 没投出去的不会有完成事件
+    }
+    return posted == n ? 0 : -1;
+}
+
+int rdma_disp_poll(rdma_disp_t *d) {
+    struct ibv_wc wc[RDMA_DISP_BATCH];
+    int n = rdma_ep_poll(d->ep, wc, RDMA_DISP_BATCH);      // 一次取回一批
+    d->polls++;
+    if (n <= 0) {
+        return n;
+    }
+    d->wcs += (uint64_t)n;
+    for (int i = 0; i < n; i++) {
+        rdma_req_t *req = take(d, wc[i].wr_id);
+        if (!req) {
+            d->stray++;
+            fprintf(stderr, "dispatcher: stray completion (wr_id=%#llx)\n",
+                    (unsigned long long)wc[i].wr_id);
+            continue;
+        }
+        if (wc[i].status != IBV_WC_SUCCESS) {
+            // QP 出错后其余在途请求都会以 FLUSH_ERR 完成，只报首个根因
+            if (!d->failed || wc[i].status != IBV_WC_WR_FLUSH_ERR) {
+                fprintf(stderr, "completion error: %s (opcode=%d)\n",
+                        ibv_wc_status_str(wc[i].status), (int)wc[i].opcode);
+            }
+            d->failed = 1;
+        }
+        req->wc = wc[i];
+        req->done = 1;
+        if (req->cb) {
+            req->cb(req, &wc[i]);                           // 回调里可以继续投递新请求
+        }
+    }
+    return n;
+}
+
+// 推进直到 cond(arg) 成立
+static int wait_until(rdma_disp_t *d, int (*cond)(rdma_disp_t *, void *), void *arg) {
+    int idle = 0;
+    while (!cond(d, arg)) {
+        int n = rdma_disp_poll(d);
+        if (n < 0) {
+            return -1;                                      // 端点出错 / 对端断开
+        }
+        if (n > 0) {
+            idle = 0;
+        } else if (++idle > RDMA_DISP_SPIN) {
+            usleep(50);                                     // 长时间无事件再让出 CPU
+        }
+    }
+    return 0;
+}
+
+static int req_done(rdma_disp_t *d, void *arg) {
+    (void)d;
+    return ((rdma_req_t *)arg)->done;
+}
+
+static int all_done(rdma_disp_t *d, void *arg) {
+    (void)arg;
+    return d->outstanding == 0;
+}
+
+int rdma_disp_wait(rdma_disp_t *d, rdma_req_t *req) {
+    if (wait_until(d, req_done, req) != 0) {
+        return -1;
+    }
+    return req->wc.status == IBV_WC_SUCCESS ? 0 : -1;
+}
+
+int rdma_disp_drain(rdma_disp_t *d) {
+    if (wait_until(d, all_done, NULL) != 0) {
+        return -1;
+    }
+    return d->failed ? -1 : 0;
+}
@@ -0,0 +1,758 @@
+﻿#include "rdma_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <endian.h>
+
+// 异步传输引擎
+// 线程模型：应用线程只做“填句柄 + 入队”
+// - 建连线程：从提交队列取出新传输，每个传输起一个连接线程（建端点、注册内存、建连、发 HELLO），
+//   完成后经就绪队列交给进度线程；连接线程由建连线程回收，引擎销毁前全部 join
+// - 进度线程：独占已交过来的端点、分发器、pacer，推进状态机
+// 慢的或连不上的对端只拖住它自己的连接线程，不影响在途传输，也不影响别的传输建连
+// 句柄的所有权随队列转移（入队 release / 出队 acquire），同一时刻只有一个线程访问端点；
+// 句柄上跨线程访问的只有 node（队列链接）、refs（引用计数）、done（完成标志），都是原子操作；
+// status / stats 在 done 置位（release）之前写好，应用线程看到 done 之后再读
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ===================== 无锁 MPSC 队列（Vyukov） =====================
+// 入队：一次原子交换抢到队头，再把前驱的 next 指过来，生产者之间互不等待
+// 出队：每个队列只有一个消费者线程，沿 next 链前进；stub 节点保证链表永不为空
+// 生产者交换完队头、还没接上 next 的瞬间，出队暂时看不到它（返回 NULL），下一轮再取
+
+typedef struct mpsc_node {
+    _Atomic(struct mpsc_node *) next;
+} mpsc_node_t;
+
+typedef struct {
+    _Atomic(mpsc_node_t *) head;          // 生产者端：最近入队的节点
+    mpsc_node_t *tail;                    // 消费者端：下一个出队的节点
+    mpsc_node_t stub;
+} mpsc_queue_t;
+
+static void mpsc_init(mpsc_queue_t *q) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+static void mpsc_push(mpsc_queue_t *q, mpsc_node_t *n) {
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+    mpsc_node_t *prev = atomic_exchange(&q->head, n);       // seq_cst：与进度线程的休眠判断配对
+    atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+static mpsc_node_t *mpsc_pop(mpsc_queue_t *q) {
+    mpsc_node_t *tail = q->tail;
+    mpsc_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &q->stub) {
+        if (!next) {
+            return NULL;
+        }
+        q->tail = next;                                     // 跳过 stub
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load(&q->head)) {
+        return NULL;                                        // 有生产者入队到一半
+    }
+    mpsc_push(q, &q->stub);                                 // tail 是最后一个节点：先把 stub 接到它后面
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static int mpsc_empty(mpsc_queue_t *q) {
+    return q->tail == &q->stub && atomic_load(&q->head) == &q->stub;
+}
+
+// ===================== 引擎与传输句柄 =====================
+
+struct rdma_engine {
+    mpsc_queue_t q;                       // 新提交的传输（建连线程消费）
+    mpsc_queue_t ready;                   // 建连完成（或失败）的传输（进度线程消费）
+    pthread_t thread;                     // 进度线程
+    pthread_t setup_thread;               // 建连线程（派发并回收连接线程）
+    int efd;                              // eventfd：进度线程无事可做时阻塞在这里
+    atomic_int sleeping;                  // 进度线程准备阻塞（建连线程据此决定要不要唤醒）
+    int setup_efd;                        // eventfd：建连线程无事可做时阻塞在这里
+    atomic_int setup_sleeping;            // 建连线程准备阻塞（提交方 / 连接线程据此决定要不要唤醒）
+    atomic_int stop;                      // 不再提交：建连线程处理完提交队列、回收全部连接线程后退出
+    atomic_int setup_exited;              // 建连线程已退出：进度线程处理完剩余传输后退出
+    atomic_int jobs_done;                 // 已结束、待回收的连接线程数
+    rdma_xport_kind_t kind;
+    int post_batch;                       // RDMA_SIM_POST_BATCH=0 时逐个投递
+    rdma_xfer_t *active;                  // 进度线程私有：在途传输链表
+};
+
+enum {
+    XF_HANDSHAKE = 0,                     // 已发 HELLO，等 MR_INFO
+    XF_DATA,                              // 分块 Write
+    XF_FIN                                // 已发 FIN，等 Write / FIN / ACK 全部完成
+};
+
+struct rdma_xfer {
+    mpsc_node_t node;                     // 必须是第一个成员：队列节点与句柄互转
+    atomic_int refs;                      // 应用一份 + 引擎一份，归零时释放
+    atomic_int done;
+    int status;
+    rdma_xfer_cb_t cb;
+    void *arg;
+
+    // 提交时确定
+    char *ip;
+    char *port;
+    int fd;                               // 源文件（内存传输为 -1）
+    const uint8_t *buf;                   // 内存传输的源缓冲区
+    uint64_t len;
+    char name[RDMA_MAX_NAME];
+    uint64_t submit_ns;
+
+    // 以下先由建连线程、交接后由进度线程访问
+    int setup_rc;                         // 建连结果（失败的也交给进度线程收尾、回调）
+    rdma_xfer_t *next_active;
+    int phase;
+    rdma_ep_t *ep;
+    rdma_disp_t disp;
+    rdma_pacer_t pacer;
+    int pacer_open;
+    rdma_mem_t data_mem;
+    rdma_mem_t ctrl_mem;
+    int data_reg;
+    int ctrl_reg;
+    struct {
+        rdma_ctrl_hello_t hello;
+        rdma_ctrl_mr_t mr_info;
+        rdma_ctrl_simple_t fin;
+        rdma_ctrl_simple_t ack;
+    } ctrl;
+    rdma_req_t r_mr, r_hello, r_ack, r_fin;
+    rdma_req_t r_write[RDMA_SEND_WINDOW];  // 在途 Write（按块序号轮转复用）
+    rdma_wr_batch_t wb;                   // 待投递的 WR 模板链
+    rdma_req_t *wb_req[RDMA_POST_BATCH];  // wb.wr[i] 对应的请求
+    const uint8_t *src;                   // 数据源：文件映射或调用方缓冲区
+    uint64_t remote_addr;
+    uint32_t remote_rkey;
+    int notify;                           // 对端是链式复制的中继：每块带 Imm
+    uint64_t offset;                      // 已投递到的偏移
+    uint32_t idx;                         // 块序号
+    uint64_t resume_ns;                   // 限速：这之前不再取令牌
+    uint64_t paced_since;                 // 限速：开始被推迟的时间（0 表示没有）
+    rdma_xfer_stats_t st;
+};
+
+// 对方登记了休眠才写 eventfd
+static void thread_wake(atomic_int *sleeping, int efd) {
+    if (atomic_exchange(sleeping, 0)) {
+        uint64_t one = 1;
+        ssize_t n = write(efd, &one, sizeof(one));
+        (void)n;                                            // 计数已非零时写失败也无妨
+    }
+}
+
+// 先登记休眠，再确认一次还是没事可做，避免错过刚入队的传输
+static void thread_sleep(atomic_int *sleeping, int efd, mpsc_queue_t *q, atomic_int *quit) {
+    atomic_store(sleeping, 1);
+    if (mpsc_empty(q) && !atomic_load(quit)) {
+        uint64_t v;
+        ssize_t r = read(efd, &v, sizeof(v));
+        (void)r;
+    }
+    atomic_store(sleeping, 0);
+}
+
+static void xfer_put(rdma_xfer_t *x) {
+    if (atomic_fetch_sub(&x->refs, 1) != 1) {
+        return;
+    }
+    free(x->ip);
+    free(x->port);
+    free(x);
+}
+
+// ===================== 建连（建连线程） =====================
+
+// 建连并发出 HELLO（同步完成；只阻塞建连线程，排在后面的新传输等它，在途传输不受影响）
+static int xfer_setup(rdma_engine_t *e, rdma_xfer_t *x) {
+    if (rdma_pacer_open(&x->pacer, x->ip) != 0) {
+        return -1;
+    }
+    x->pacer_open = 1;
+    if (rdma_ep_create(e->kind, x->ip, x->port, &x->ep) != 0) {
+        fprintf(stderr, "%s: create %s endpoint failed\n", x->name, rdma_xport_name(e->kind));
+        return -1;
+    }
+    x->st.kind = rdma_ep_kind(x->ep);
+
+    // 数据源：文件映射后注册；内存直接注册（空缓冲区不需要注册，也不会有 Write）
+    if (x->fd >= 0) {
+        if (rdma_mem_reg_file(x->ep, x->fd, (size_t)x->len, 0, &x->data_mem) != 0) {
+            fprintf(stderr, "%s: register file MR failed\n", x->name);
+            return -1;
+        }
+        x->data_reg = 1;
+        x->src = (const uint8_t *)x->data_mem.addr;
+    } else if (x->len) {
+        if (rdma_mem_reg(x->ep, (void *)x->buf, (size_t)x->len, 0, &x->data_mem) != 0) {
+            fprintf(stderr, "%s: register buffer MR failed\n", x->name);
+            return -1;
+        }
+        x->data_reg = 1;
+        x->src = x->buf;
+    }
+
+    x->ctrl.hello.type = htonl(RDMA_CTRL_HELLO);
+    x->ctrl.hello.name_len = htonl((uint32_t)strlen(x->name));
+    x->ctrl.hello.file_size = htobe64(x->len);
+    memcpy(x->ctrl.hello.name, x->name, sizeof(x->ctrl.hello.name));     // 两边同长，name 已以 0 结尾
+    x->ctrl.fin.type = htonl(RDMA_CTRL_FIN);
+    if (rdma_mem_reg(x->ep, &x->ctrl, sizeof(x->ctrl), IBV_ACCESS_LOCAL_WRITE, &x->ctrl_mem) != 0) {
+        fprintf(stderr, "%s: register ctrl MR failed\n", x->name);
+        return -1;
+    }
+    x->ctrl_reg = 1;
+
+    // 先挂 MR_INFO 的接收，再建连、发 HELLO
+    rdma_disp_init(&x->disp, x->ep);
+    if (rdma_disp_post_recv(&x->disp, &x->r_mr, &x->ctrl.mr_info, sizeof(x->ctrl.mr_info),
+                            &x->ctrl_mem) != 0) {
+        fprintf(stderr, "%s: post recv MR_INFO failed\n", x->name);
+        return -1;
+    }
+    if (rdma_ep_connect(x->ep) != 0) {
+        fprintf(stderr, "%s: connect failed\n", x->name);
+        return -1;
+    }
+    if (rdma_disp_post_send(&x->disp, &x->r_hello, &x->ctrl.hello, sizeof(x->ctrl.hello),
+                            &x->ctrl_mem) != 0) {
+        fprintf(stderr, "%s: post send HELLO failed\n", x->name);
+        return -1;
+    }
+    x->phase = XF_HANDSHAKE;
+    return 0;
+}
+
+// 一个连接线程（建连线程私有的链表，回收时 join）
+typedef struct setup_job {
+    pthread_t tid;
+    rdma_engine_t *e;
+    rdma_xfer_t *x;
+    atomic_int finished;
+    struct setup_job *next;
+} setup_job_t;
+
+// 建连并交给进度线程（出队后节点可复用）
+static void setup_one(rdma_engine_t *e, rdma_xfer_t *x) {
+    x->setup_rc = xfer_setup(e, x);
+    mpsc_push(&e->ready, &x->node);
+    thread_wake(&e->sleeping, e->efd);
+}
+
+static void *job_main(void *arg) {
+    setup_job_t *j = (setup_job_t *)arg;
+    rdma_engine_t *e = j->e;
+    setup_one(e, j->x);
+    atomic_store(&j->finished, 1);
+    atomic_fetch_add(&e->jobs_done, 1);                     // 引擎在全部 join 之前不会释放
+    thread_wake(&e->setup_sleeping, e->setup_efd);
+    return NULL;
+}
+
+// 回收连接线程：all 为 0 时只回收已结束的
+static setup_job_t *reap_jobs(rdma_engine_t *e, setup_job_t *jobs, int all) {
+    setup_job_t **pp = &jobs;
+    while (*pp) {
+        setup_job_t *j = *pp;
+        if (!all && !atomic_load(&j->finished)) {
+            pp = &j->next;
+            continue;
+        }
+        pthread_join(j->tid, NULL);
+        if (atomic_load(&j->finished)) {
+            atomic_fetch_sub(&e->jobs_done, 1);
+        }
+        *pp = j->next;
+        free(j);
+    }
+    return jobs;
+}
+
+static void *setup_main(void *arg) {
+    rdma_engine_t *e = (rdma_engine_t *)arg;
+    setup_job_t *jobs = NULL;
+    while (1) {
+        mpsc_node_t *n;
+        while ((n = mpsc_pop(&e->q)) != NULL) {
+            rdma_xfer_t *x = (rdma_xfer_t *)n;
+            setup_job_t *j = (setup_job_t *)calloc(1, sizeof(*j));
+            if (j) {
+                j->e = e;
+                j->x = x;
+                atomic_init(&j->finished, 0);
+                if (pthread_create(&j->tid, NULL, job_main, j) == 0) {
+                    j->next = jobs;
+                    jobs = j;
+                    continue;
+                }
+                free(j);
+            }
+            setup_one(e, x);                                // 起不了线程：就地建连
+        }
+        if (atomic_load(&e->jobs_done) > 0) {
+            jobs = reap_jobs(e, jobs, 0);
+        }
+        if (!mpsc_empty(&e->q)) {
+            usleep(50);                                     // 有生产者入队到一半
+            continue;
+        }
+        if (atomic_load(&e->stop)) {
+            break;                                          // 已提交的都派出去了
+        }
+        atomic_store(&e->setup_sleeping, 1);
+        if (mpsc_empty(&e->q) && !atomic_load(&e->stop) && atomic_load(&e->jobs_done) == 0) {
+            uint64_t v;
+            ssize_t r = read(e->setup_efd, &v, sizeof(v));
+            (void)r;
+        }
+        atomic_store(&e->setup_sleeping, 0);
+    }
+    reap_jobs(e, jobs, 1);                                  // 等所有连接线程交完
+    atomic_store(&e->setup_exited, 1);
+    thread_wake(&e->sleeping, e->efd);
+    return NULL;
+}
+
+// ===================== 传输状态机（进度线程） =====================
+// 投递 wb 中攒下的 WR
+static int xfer_flush(rdma_engine_t *e, rdma_xfer_t *x) {
+    int n = x->wb.n;
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t t0 = now_ns();
+    int rc;
+    if (e->post_batch) {
+        rc = rdma_disp_post_batch(&x->disp, &x->wb, x->wb_req);
+    } else {
+        // 对照：逐个投递（此时 wb 里只有一个 WR）
+        struct ibv_send_wr *wr = &x->wb.wr[0];
+        rc = x->notify
+            ? rdma_disp_post_write_imm(&x->disp, x->wb_req[0], wr->sg_list, 1, wr->wr.rdma.remote_addr,
+                                       x->remote_rkey, ntohl(wr->imm_data))
+            : rdma_disp_post_write(&x->disp, x->wb_req[0], wr->sg_list, 1, wr->wr.rdma.remote_addr,
+                                   x->remote_rkey);
+        x->wb.n = 0;
+    }
+    x->st.post_ns += now_ns() - t0;
+    x->st.post_calls++;
+    x->st.wrs += (uint32_t)n;
+    if (rc != 0) {
+        fprintf(stderr, "%s: post RDMA write failed\n", x->name);
+    }
+    return rc;
+}
+
+// 把窗口里空出的槽位填满并投递；限速时记下恢复时间，交给下一轮
+static int xfer_post_data(rdma_engine_t *e, rdma_xfer_t *x, uint64_t now) {
+    if (now < x->resume_ns) {
+        return 0;
+    }
+    while (x->offset < x->len) {
+        // 一批最多一个窗口：再多就会绕回本批已占用的请求
+        rdma_req_t *w = &x->r_write[x->idx % RDMA_SEND_WINDOW];
+        if (x->wb.n == RDMA_SEND_WINDOW || x->wb.n == RDMA_POST_BATCH ||
+            (x->idx >= RDMA_SEND_WINDOW && !w->done)) {
+            break;
+        }
+        uint32_t chunk = RDMA_CHUNK;
+        if (x->offset + chunk > x->len) {
+            chunk = (uint32_t)(x->len - x->offset);
+        }
+        uint64_t wait = rdma_pacer_try(&x->pacer, chunk);
+        if (wait) {
+            x->resume_ns = now + wait;
+            if (!x->paced_since) {
+                x->paced_since = now;
+            }
+            break;
+        }
+        if (x->paced_since) {
+            x->st.paced_ns += now - x->paced_since;
+            x->paced_since = 0;
+        }
+        x->wb_req[x->wb.n] = w;
+        rdma_wr_batch_add(&x->wb, (uintptr_t)(x->src + x->offset), chunk,
+                          x->remote_addr + x->offset, x->idx, 0);
+        x->offset += chunk;
+        x->idx++;
+        if (!e->post_batch && xfer_flush(e, x) != 0) {
+            return -1;
+        }
+    }
+    return xfer_flush(e, x);
+}
+
+// 推进一个传输：返回 0 表示仍在进行，1 表示成功结束，-1 表示失败
+static int xfer_step(rdma_engine_t *e, rdma_xfer_t *x, uint64_t now) {
+    if (x->disp.failed) {
+        fprintf(stderr, "%s: completion failed\n", x->name);
+        return -1;
+    }
+    switch (x->phase) {
+    case XF_HANDSHAKE:
+        if (!x->r_hello.done || !x->r_mr.done) {
+            return 0;
+        }
+        if (ntohl(x->ctrl.mr_info.type) != RDMA_CTRL_MR) {
+            fprintf(stderr, "%s: invalid MR_INFO type\n", x->name);
+            return -1;
+        }
+        x->remote_addr = be64toh(x->ctrl.mr_info.addr);
+        x->remote_rkey = ntohl(x->ctrl.mr_info.rkey);
+        if (x->len > be64toh(x->ctrl.mr_info.length)) {
+            fprintf(stderr, "%s: remote MR too small\n", x->name);
+            return -1;
+        }
+        x->notify = (ntohl(x->ctrl.mr_info.flags) & RDMA_MR_F_NOTIFY) != 0;
+        // ACK 的接收提前挂上：与数据同时在途，由分发器按 wr_id 区分
+        if (rdma_disp_post_recv(&x->disp, &x->r_ack, &x->ctrl.ack, sizeof(x->ctrl.ack),
+                                &x->ctrl_mem) != 0) {
+            fprintf(stderr, "%s: post recv ACK failed\n", x->name);
+            return -1;
+        }
+        rdma_wr_batch_init(&x->wb, x->notify ? IBV_WR_RDMA_WRITE_WITH_IMM : IBV_WR_RDMA_WRITE,
+                           x->data_mem.lkey, x->remote_rkey);
+        x->phase = XF_DATA;
+        /* fall through */
+    case XF_DATA:
+        if (xfer_post_data(e, x, now) != 0) {
+            return -1;
+        }
+        if (x->offset < x->len) {
+            return 0;
+        }
+        // RC 保序：FIN 在对端交付时，之前的 Write 已全部落位，不必先等 Write 完成
+        if (rdma_disp_post_send(&x->disp, &x->r_fin, &x->ctrl.fin, sizeof(x->ctrl.fin),
+                                &x->ctrl_mem) != 0) {
+            fprintf(stderr, "%s: post send FIN failed\n", x->name);
+            return -1;
+        }
+        x->phase = XF_FIN;
+        /* fall through */
+    case XF_FIN:
+        if (x->disp.outstanding) {
+            return 0;
+        }
+        if (ntohl(x->ctrl.ack.type) != RDMA_CTRL_ACK) {
+            fprintf(stderr, "%s: invalid ACK type\n", x->name);
+            return -1;
+        }
+        return 1;
+    }
+    return -1;
+}
+
+// 释放传输占用的资源，公布结果，再调用回调
+static void xfer_finish(rdma_xfer_t *x, int status) {
+    if (x->ctrl_reg) {
+        rdma_mem_dereg(x->ep, &x->ctrl_mem);
+    }
+    if (x->data_reg) {
+        rdma_mem_dereg(x->ep, &x->data_mem);
+    }
+    if (x->ep) {
+        rdma_ep_close(x->ep);
+        x->ep = NULL;
+    }
+    if (x->fd >= 0) {
+        close(x->fd);
+        x->fd = -1;
+    }
+    if (x->pacer_open) {
+        rdma_pacer_close(&x->pacer);
+    }
+    x->st.bytes = status == 0 ? x->len : 0;
+    x->st.elapsed_ns = now_ns() - x->submit_ns;
+    x->status = status;
+    atomic_store_explicit(&x->done, 1, memory_order_release);
+    if (x->cb) {
+        x->cb(x, status, x->arg);
+    }
+    xfer_put(x);                                            // 引擎的那份引用
+}
+
+static void *progress_main(void *arg) {
+    rdma_engine_t *e = (rdma_engine_t *)arg;
+    int idle = 0;
+    while (1) {
+        int busy = 0;
+
+        // 1) 取出建连线程交过来的传输，挂进在途链表（建连失败的直接收尾）
+        mpsc_node_t *n;
+        while ((n = mpsc_pop(&e->ready)) != NULL) {
+            rdma_xfer_t *x = (rdma_xfer_t *)n;
+            busy = 1;
+            if (x->setup_rc != 0) {
+                xfer_finish(x, -1);
+                continue;
+            }
+            x->next_active = e->active;
+            e->active = x;
+        }
+
+        // 2) 逐个推进在途传输：成批取回完成事件，再走状态机
+        uint64_t now = now_ns();
+        rdma_xfer_t **pp = &e->active;
+        while (*pp) {
+            rdma_xfer_t *x = *pp;
+            int ev = rdma_disp_poll(&x->disp);
+            int rc;
+            if (ev < 0) {
+                fprintf(stderr, "%s: connection failed\n", x->name);   // 端点出错 / 对端断开
+                rc = -1;
+            } else {
+                rc = xfer_step(e, x, now);
+            }
+            if (ev > 0) {
+                busy = 1;
+            }
+            if (rc == 0) {
+                pp = &x->next_active;
+                continue;
+            }
+            *pp = x->next_active;
+            xfer_finish(x, rc > 0 ? 0 : -1);
+            busy = 1;
+        }
+
+        if (busy) {
+            idle = 0;
+            continue;
+        }
+        int exited = atomic_load(&e->setup_exited);         // 先读：它退出前交出的传输下面一定看得到
+        if (e->active || !mpsc_empty(&e->ready)) {
+            if (++idle > RDMA_DISP_SPIN) {
+                usleep(50);                                 // 长时间无事件再让出 CPU
+            }
+            continue;
+        }
+        if (exited) {
+            break;                                          // 已提交的都结束了
+        }
+
+        // 3) 无事可做：阻塞到建连线程交来新传输
+        thread_sleep(&e->sleeping, e->efd, &e->ready, &e->setup_exited);
+        idle = 0;
+    }
+    return NULL;
+}
+
+// ===================== 对外接口 =====================
+
+int rdma_engine_create(rdma_engine_t **out_e) {
+    rdma_xport_kind_t kind;
+    if (rdma_xport_from_env(&kind) != 0) {
+        return -1;
+    }
+    rdma_engine_t *e = (rdma_engine_t *)calloc(1, sizeof(*e));
+    if (!e) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+    mpsc_init(&e->q);
+    mpsc_init(&e->ready);
+    atomic_init(&e->sleeping, 0);
+    atomic_init(&e->setup_sleeping, 0);
+    atomic_init(&e->stop, 0);
+    atomic_init(&e->setup_exited, 0);
+    atomic_init(&e->jobs_done, 0);
+    e->kind = kind;
+    const char *pb = getenv("RDMA_SIM_POST_BATCH");
+    e->post_batch = !(pb && strcmp(pb, "0") == 0);
+    e->efd = eventfd(0, EFD_CLOEXEC);
+    e->setup_efd = eventfd(0, EFD_CLOEXEC);
+    if (e->efd < 0 || e->setup_efd < 0) {
+        perror("eventfd");
+        goto fail;
+    }
+    if (pthread_create(&e->thread, NULL, progress_main, e) != 0) {
+        fprintf(stderr, "create progress thread failed\n");
+        goto fail;
+    }
+    if (pthread_create(&e->setup_thread, NULL, setup_main, e) != 0) {
+        fprintf(stderr, "create setup thread failed\n");
+        atomic_store(&e->setup_exited, 1);                  // 让进度线程直接退出
+        thread_wake(&e->sleeping, e->efd);
+        pthread_join(e->thread, NULL);
+        goto fail;
+    }
+    *out_e = e;
+    return 0;
+
+fail:
+    if (e->efd >= 0) {
+        close(e->efd);
+    }
+    if (e->setup_efd >= 0) {
+        close(e->setup_efd);
+    }
+    free(e);
+    return -1;
+}
+
+void rdma_engine_destroy(rdma_engine_t *e) {
+    if (!e) {
+        return;
+    }
+    // 先让建连线程交完已提交的传输，进度线程随后把它们推进完再退出
+    atomic_store(&e->stop, 1);
+    thread_wake(&e->setup_sleeping, e->setup_efd);
+    pthread_join(e->setup_thread, NULL);
+    pthread_join(e->thread, NULL);
+    close(e->efd);
+    close(e->setup_efd);
+    free(e);
+}
+
+static rdma_xfer_t *xfer_new(const char *ip, const char *port, rdma_xfer_cb_t cb, void *arg) {
+    rdma_xfer_t *x = (rdma_xfer_t *)calloc(1, sizeof(*x));
+    if (!x) {
+        fprintf(stderr, "malloc failed\n");
+        return NULL;
+    }
+    x->ip = strdup(ip);
+    x->port = strdup(port);
+    if (!x->ip || !x->port) {
+        fprintf(stderr, "malloc failed\n");
+        free(x->ip);
+        free(x->port);
+        free(x);
+        return NULL;
+    }
+    x->fd = -1;
+    x->cb = cb;
+    x->arg = arg;
+    return x;
+}
+
+static void xfer_submit(rdma_engine_t *e, rdma_xfer_t *x, rdma_xfer_t **out_x) {
+    atomic_init(&x->refs, 2);
+    atomic_init(&x->done, 0);
+    x->submit_ns = now_ns();
+    *out_x = x;                                             // 入队后引擎可能立即完成它
+    mpsc_push(&e->q, &x->node);
+    thread_wake(&e->setup_sleeping, e->setup_efd);
+}
+
+int rdma_xfer_submit_file(rdma_engine_t *e, const char *ip, const char *port, const char *path,
+                          rdma_xfer_cb_t cb, void *arg, rdma_xfer_t **out_x) {
+    // 只传文件名，不传路径（避免路径注入 & 便于接收端落盘）
+    char *path_copy = strdup(path);
+    if (!path_copy) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+    const char *name = basename(path_copy);
+    if (strlen(name) >= RDMA_MAX_NAME) {
+        fprintf(stderr, "file name too long\n");
+        free(path_copy);
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        free(path_copy);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "not a regular file: %s\n", path);
+        close(fd);
+        free(path_copy);
+        return -1;
+    }
+    rdma_xfer_t *x = xfer_new(ip, port, cb, arg);
+    if (!x) {
+        close(fd);
+        free(path_copy);
+        return -1;
+    }
+    strncpy(x->name, name, RDMA_MAX_NAME - 1);
+    free(path_copy);
+    x->fd = fd;
+    x->len = (uint64_t)st.st_size;
+    xfer_submit(e, x, out_x);
+    return 0;
+}
+
+int rdma_xfer_submit_buf(rdma_engine_t *e, const char *ip, const char *port, const void *buf,
+                         size_t len, const char *name, rdma_xfer_cb_t cb, void *arg,
+                         rdma_xfer_t **out_x) {
+    if (!name || !*name || strlen(name) >= RDMA_MAX_NAME || strchr(name, '/')) {
+        fprintf(stderr, "invalid transfer name\n");
+        return -1;
+    }
+    rdma_xfer_t *x = xfer_new(ip, port, cb, arg);
+    if (!x) {
+        return -1;
+    }
+    strncpy(x->name, name, RDMA_MAX_NAME - 1);
+    x->buf = (const uint8_t *)buf;
+    x->len = (uint64_t)len;
+    xfer_submit(e, x, out_x);
+    return 0;
+}
+
+int rdma_xfer_test(rdma_xfer_t *x) {
+    return atomic_load_explicit(&x->done, memory_order_acquire);
+}
+
+int rdma_xfer_wait(rdma_xfer_t *x) {
+    // 先自旋，再逐步拉长睡眠（最长 1ms）：大量线程同时等待时不至于空转
+    useconds_t nap = 0;
+    for (int spin = 0; !rdma_xfer_test(x); spin++) {
+        if (spin < RDMA_DISP_SPIN) {
+            continue;
+        }
+        nap = nap ? (nap < 1000 ? nap * 2 : 1000) : 50;
+        usleep(nap);
+    }
+    return x->status;
+}
+
+int rdma_xfer_stats(rdma_xfer_t *x, rdma_xfer_stats_t *out) {
+    if (!rdma_xfer_test(x)) {
+        return -1;
+    }
+    *out = x->st;
+    return 0;
+}
+
+void rdma_xfer_release(rdma_xfer_t *x) {
+    if (x) {
+        xfer_put(x);
+    }
+}
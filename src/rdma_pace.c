@@ -0,0 +1,290 @@
+﻿#define _GNU_SOURCE
+#include "rdma_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// QoS：令牌桶限速 + 优先级让路
+// 令牌桶用 GCRA 表示：只保存“理论到达时间” tat，每放行 bytes 字节，tat 前进 bytes/rate；
+// tat 超前当前时间不超过桶深（RDMA_PACE_BURST_NS）时立即放行，否则睡到差值回到桶深以内。
+// 对端桶的 tat 放在共享内存里，用 CAS 更新，多个进程可以同时预约。
+
+#define PACE_MAGIC 0x52504345u            // "RPCE"
+#define PACE_VERSION 1
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / 1000000000ull);
+    ts.tv_nsec = (long)(ns % 1000000000ull);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static uint64_t mbps_to_bps(const char *v) {
+    double mbps = atof(v);
+    return mbps > 0 ? (uint64_t)(mbps * 1e6) : 0;
+}
+
+int rdma_pace_prio_from_name(const char *name) {
+    if (strcmp(name, "high") == 0) {
+        return RDMA_PRIO_HIGH;
+    }
+    if (strcmp(name, "normal") == 0) {
+        return RDMA_PRIO_NORMAL;
+    }
+    if (strcmp(name, "bulk") == 0) {
+        return RDMA_PRIO_BULK;
+    }
+    return -1;
+}
+
+const char *rdma_pace_prio_name(int prio) {
+    static const char *names[RDMA_PRIO_CLASSES] = { "high", "normal", "bulk" };
+    return prio >= 0 && prio < RDMA_PRIO_CLASSES ? names[prio] : "unknown";
+}
+
+int rdma_pace_peer_open(const char *peer, rdma_pace_peer_t **out_peer) {
+    // 共享内存名：/rdma_sim.pace.<peer>，非字母数字字符替换为 '_'（IPv6 地址里的 ':' 等）
+    char name[128];
+    int n = snprintf(name, sizeof(name), "/rdma_sim.pace.%s", peer);
+    if (n < 0 || (size_t)n >= sizeof(name)) {
+        return -1;
+    }
+    for (char *c = name + 1; *c; c++) {
+        if (!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+              *c == '.' || *c == '-')) {
+            *c = '_';
+        }
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror("shm_open pace state");
+        return -1;
+    }
+    struct stat st;
+    // 全零就是合法的初始状态（不限速、无人登记），多个进程同时创建也无妨
+    if (fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size < sizeof(rdma_pace_peer_t) &&
+         ftruncate(fd, (off_t)sizeof(rdma_pace_peer_t)) != 0)) {
+        perror("size pace state");
+        close(fd);
+        return -1;
+    }
+    rdma_pace_peer_t *p = (rdma_pace_peer_t *)mmap(NULL, sizeof(*p), PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap pace state");
+        return -1;
+    }
+    uint32_t zero = 0;
+    __atomic_compare_exchange_n(&p->magic, &zero, PACE_MAGIC, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&p->magic, __ATOMIC_ACQUIRE) != PACE_MAGIC) {
+        fprintf(stderr, "pace state %s: bad magic\n", name);
+        munmap(p, sizeof(*p));
+        return -1;
+    }
+    __atomic_store_n(&p->version, PACE_VERSION, __ATOMIC_RELEASE);
+    *out_peer = p;
+    return 0;
+}
+
+void rdma_pace_peer_close(rdma_pace_peer_t *peer) {
+    if (peer) {
+        munmap(peer, sizeof(*peer));
+    }
+}
+
+// 登记一个传输：占用空闲槽位，或回收已退出进程留下的槽位
+static rdma_pace_slot_t *claim_slot(rdma_pace_peer_t *peer) {
+    int32_t self = (int32_t)getpid();
+    for (int i = 0; i < RDMA_PACE_SLOTS; i++) {
+        rdma_pace_slot_t *s = &peer->slot[i];
+        int32_t pid = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE);
+        if (pid != 0 && (kill(pid, 0) == 0 || errno != ESRCH)) {
+            continue;                                       // 仍在使用
+        }
+        if (__atomic_compare_exchange_n(&s->pid, &pid, self, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+int rdma_pacer_open(rdma_pacer_t *p, const char *peer) {
+    memset(p, 0, sizeof(*p));
+    p->prio = RDMA_PRIO_NORMAL;
+    p->slot = &p->local;
+
+    const char *prio = getenv("RDMA_SIM_PRIO");
+    if (prio && *prio) {
+        p->prio = rdma_pace_prio_from_name(prio);
+        if (p->prio < 0) {
+            fprintf(stderr, "unknown RDMA_SIM_PRIO: %s\n", prio);
+            return -1;
+        }
+    }
+    const char *rate = getenv("RDMA_SIM_RATE_MBPS");
+    uint64_t rate_bps = rate && *rate ? mbps_to_bps(rate) : 0;
+
+    // 对端共享状态打不开时仍可单传输限速，只是对端限速与优先级失效
+    if (rdma_pace_peer_open(peer, &p->peer) == 0) {
+        // 槽位满了：对端限速与优先级照常生效，本传输的状态放在 local，只是 pacectl 看不到
+        rdma_pace_slot_t *s = claim_slot(p->peer);
+        if (s) {
+            p->slot = s;
+        } else {
+            fprintf(stderr, "[pace] too many transfers to %s, not visible to pacectl\n", peer);
+        }
+    } else {
+        fprintf(stderr, "[pace] peer state unavailable, per-transfer pacing only\n");
+    }
+    __atomic_store_n(&p->slot->prio, (uint32_t)p->prio, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->slot->rate_bps, rate_bps, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->slot->sent_bytes, 0, __ATOMIC_RELAXED);
+
+    const char *peer_rate = getenv("RDMA_SIM_PEER_RATE_MBPS");
+    if (p->peer && peer_rate && *peer_rate) {
+        __atomic_store_n(&p->peer->rate_bps, mbps_to_bps(peer_rate), __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+void rdma_pacer_close(rdma_pacer_t *p) {
+    if (p->peer) {
+        if (p->slot != &p->local) {
+            __atomic_store_n(&p->slot->pid, 0, __ATOMIC_RELEASE);
+        }
+        rdma_pace_peer_close(p->peer);
+    }
+    p->peer = NULL;
+    p->slot = &p->local;
+}
+
+// 在 tat 上预约 bytes 字节，返回还需等待的纳秒数
+// 桶深至少容纳一个块：否则大块在低速率下永远“超额”
+static uint64_t reserve(uint64_t *tat, int shared, uint64_t rate_bps, size_t bytes, uint64_t now) {
+    uint64_t cost = (uint64_t)((double)bytes * 1e9 / (double)rate_bps);
+    uint64_t burst = cost > RDMA_PACE_BURST_NS ? cost : RDMA_PACE_BURST_NS;
+    uint64_t old = shared ? __atomic_load_n(tat, __ATOMIC_ACQUIRE) : *tat;
+    uint64_t next;
+    do {
+        next = (old > now ? old : now) + cost;
+    } while (shared &&
+             !__atomic_compare_exchange_n(tat, &old, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    if (!shared) {
+        *tat = next;
+    }
+    return next > now + burst ? next - now - burst : 0;
+}
+
+// 非阻塞版本的 reserve：预约后仍在桶深以内才提交并返回 0，
+// 否则不动 tat，返回还需等待的纳秒数
+static uint64_t try_reserve(uint64_t *tat, int shared, uint64_t rate_bps, size_t bytes, uint64_t now) {
+    uint64_t cost = (uint64_t)((double)bytes * 1e9 / (double)rate_bps);
+    uint64_t burst = cost > RDMA_PACE_BURST_NS ? cost : RDMA_PACE_BURST_NS;
+    uint64_t old = shared ? __atomic_load_n(tat, __ATOMIC_ACQUIRE) : *tat;
+    uint64_t next;
+    do {
+        next = (old > now ? old : now) + cost;
+        if (next > now + burst) {
+            return next - now - burst;
+        }
+    } while (shared &&
+             !__atomic_compare_exchange_n(tat, &old, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    if (!shared) {
+        *tat = next;
+    }
+    return 0;
+}
+
+// 更高优先级最近是否在发送
+static int higher_active(rdma_pacer_t *p, uint64_t now) {
+    for (int c = 0; c < p->prio; c++) {
+        if (__atomic_load_n(&p->peer->active_ns[c], __ATOMIC_ACQUIRE) + RDMA_PACE_ACTIVE_NS > now) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 有更高优先级的传输在发送时让路
+static void yield_to_higher(rdma_pacer_t *p) {
+    while (1) {
+        uint64_t now = now_ns();
+        if (!higher_active(p, now)) {
+            return;
+        }
+        usleep(RDMA_PACE_YIELD_US);
+        p->waited_ns += now_ns() - now;
+    }
+}
+
+void rdma_pacer_take(rdma_pacer_t *p, size_t bytes) {
+    if (p->peer && p->prio > RDMA_PRIO_HIGH) {
+        yield_to_higher(p);
+    }
+
+    // 单传输限速（速率每次重新读取，pacectl 可随时修改）
+    uint64_t rate = __atomic_load_n(&p->slot->rate_bps, __ATOMIC_ACQUIRE);
+    if (rate) {
+        uint64_t wait = reserve(&p->tat_ns, 0, rate, bytes, now_ns());
+        if (wait) {
+            sleep_ns(wait);
+            p->waited_ns += wait;
+        }
+    }
+
+    if (p->peer) {
+        // 先标记“本优先级正在发送”，再排对端的桶：低优先级在这期间就会让路
+        __atomic_store_n(&p->peer->active_ns[p->prio], now_ns(), __ATOMIC_RELEASE);
+        uint64_t peer_rate = __atomic_load_n(&p->peer->rate_bps, __ATOMIC_ACQUIRE);
+        if (peer_rate) {
+            uint64_t wait = reserve(&p->peer->tat_ns, 1, peer_rate, bytes, now_ns());
+            if (wait) {
+                sleep_ns(wait);
+                p->waited_ns += wait;
+            }
+        }
+    }
+    __atomic_add_fetch(&p->slot->sent_bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+}
+
+uint64_t rdma_pacer_try(rdma_pacer_t *p, size_t bytes) {
+    uint64_t now = now_ns();
+    if (p->peer && p->prio > RDMA_PRIO_HIGH && higher_active(p, now)) {
+        return (uint64_t)RDMA_PACE_YIELD_US * 1000;
+    }
+
+    uint64_t saved = p->tat_ns;
+    uint64_t rate = __atomic_load_n(&p->slot->rate_bps, __ATOMIC_ACQUIRE);
+    uint64_t wait = 0;
+    if (rate && (wait = try_reserve(&p->tat_ns, 0, rate, bytes, now)) != 0) {
+        return wait;
+    }
+    if (p->peer) {
+        __atomic_store_n(&p->peer->active_ns[p->prio], now, __ATOMIC_RELEASE);
+        uint64_t peer_rate = __atomic_load_n(&p->peer->rate_bps, __ATOMIC_ACQUIRE);
+        if (peer_rate && (wait = try_reserve(&p->peer->tat_ns, 1, peer_rate, bytes, now)) != 0) {
+            p->tat_ns = saved;                              // 对端桶没令牌：退回单传输桶的预约
+            return wait;
+        }
+    }
+    __atomic_add_fetch(&p->slot->sent_bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 
 // 等待并校验指定类型的 RDMA CM 事件
 // 关键点：
@@ -29,6 +30,7 @@ int rdma_wait_event(struct rdma_event_channel *ec, enum rdma_cm_event_type expec
 // 1) 创建 PD 作为资源归属
 // 2) 创建 CQ 用于完成通知
 // 3) 创建 QP（RC 类型）
+// 4) 发送 SGE 数量按设备 max_sge 申请（与 RDMA_MAX_SGE 取小），供多 SGE 聚合写使用
 int rdma_build_qp(struct rdma_cm_id *id, struct ibv_pd **pd, struct ibv_cq **cq, struct ibv_comp_channel **comp_chan) {
     *pd = ibv_alloc_pd(id->verbs);                      // 分配 PD
     if (!*pd) {
@@ -40,7 +42,7 @@ int rdma_build_qp(struct rdma_cm_id *id, struct ibv_pd **pd, struct ibv_cq **cq,
         return -1;
     }
 
-    *cq = ibv_create_cq(id->verbs, 16, NULL, *comp_chan, 0); // CQ 深度 16
+    *cq = ibv_create_cq(id->verbs, 2 * RDMA_QP_DEPTH, NULL, *comp_chan, 0); // 容纳收发两侧的完成事件
     if (!*cq) {
         return -1;
     }
@@ -49,14 +51,26 @@ int rdma_build_qp(struct rdma_cm_id *id, struct ibv_pd **pd, struct ibv_cq **cq,
         return -1;
     }
 
+    struct ibv_device_attr dev_attr;                    // 设备能力
+    if (ibv_query_device(id->verbs, &dev_attr) != 0) {
+        return -1;
+    }
+    int send_sge = dev_attr.max_sge;                    // 设备支持的最大 SGE 数
+    if (send_sge > RDMA_MAX_SGE) {
+        send_sge = RDMA_MAX_SGE;                        // 上限保护，避免 WQE 过大
+    }
+    if (send_sge < 1) {
+        send_sge = 1;
+    }
+
     struct ibv_qp_init_attr qp_attr;                    // QP 初始化参数
     memset(&qp_attr, 0, sizeof(qp_attr));
     qp_attr.send_cq = *cq;                              // 发送 CQ
     qp_attr.recv_cq = *cq;                              // 接收 CQ
     qp_attr.qp_type = IBV_QPT_RC;                       // 可靠连接（RC）
-    qp_attr.cap.max_send_wr = 16;                       // 发送 WR 深度
-    qp_attr.cap.max_recv_wr = 16;                       // 接收 WR 深度
-    qp_attr.cap.max_send_sge = 1;                       // 发送 SGE 数量
+    qp_attr.cap.max_send_wr = RDMA_QP_DEPTH;            // 发送 WR 深度
+    qp_attr.cap.max_recv_wr = RDMA_QP_DEPTH;            // 接收 WR 深度
+    qp_attr.cap.max_send_sge = (uint32_t)send_sge;      // 发送 SGE 数量（聚合写）
     qp_attr.cap.max_recv_sge = 1;                       // 接收 SGE 数量
 
     if (rdma_create_qp(id, *pd, &qp_attr) != 0) {        // 创建 QP
@@ -65,6 +79,19 @@ int rdma_build_qp(struct rdma_cm_id *id, struct ibv_pd **pd, struct ibv_cq **cq,
     return 0;
 }
 
+// 查询 QP 实际可用的发送 SGE 数量
+// 说明：rdma_create_qp 之后驱动给出的 cap 才是最终值，这里直接问 QP
+int rdma_query_max_sge(struct rdma_cm_id *id, int *out_max_sge) {
+    struct ibv_qp_attr attr;                             // QP 属性
+    struct ibv_qp_init_attr init_attr;                   // QP 初始化属性（含 cap）
+    if (ibv_query_qp(id->qp, &attr, IBV_QP_CAP, &init_attr) != 0) {
+        return -1;
+    }
+    int n = (int)init_attr.cap.max_send_sge;
+    *out_max_sge = n > 0 ? n : 1;                        // 至少 1 个
+    return 0;
+}
+
 // 注册 MR
 // - buf：待注册的内存
 // - len：长度
@@ -137,11 +164,20 @@ int rdma_post_write(struct rdma_cm_id *id, void *buf, size_t len, struct ibv_mr
     sge.length = (uint32_t)len;                          // 写入长度
     sge.lkey = mr->lkey;                                 // 本地 key
 
+    return rdma_post_write_sg(id, &sge, 1, remote_addr, rkey, wr_id);
+}
+
+// Post RDMA Write（多 SGE 聚合写）
+// 关键点：一个 WR 携带多个 SGE，网卡按顺序从各本地缓冲区取数据，
+// 拼成一段连续数据写到 remote_addr 开始的位置
+// 好处：多个小文件只消耗一个 WR、一次完成事件
+int rdma_post_write_sg(struct rdma_cm_id *id, struct ibv_sge *sge, int num_sge,
+                       uint64_t remote_addr, uint32_t rkey, uint64_t wr_id) {
     struct ibv_send_wr wr;                               // 发送 WR
     memset(&wr, 0, sizeof(wr));
     wr.wr_id = wr_id;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
+    wr.sg_list = sge;                                    // SGE 数组
+    wr.num_sge = num_sge;                                // SGE 数量
     wr.opcode = IBV_WR_RDMA_WRITE;                       // RDMA Write 操作
     wr.send_flags = IBV_SEND_SIGNALED;                   // 请求完成事件
     wr.wr.rdma.remote_addr = remote_addr;                // 对端地址
@@ -154,6 +190,55 @@ int rdma_post_write(struct rdma_cm_id *id, void *buf, size_t len, struct ibv_mr
     return 0;
 }
 
+// 批量投递：初始化 WR 模板
+// 不变的字段只填一次；next 预先串好，投递时只需在最后一个 WR 处断开
+void rdma_wr_batch_init(rdma_wr_batch_t *b, enum ibv_wr_opcode op, uint32_t lkey, uint32_t rkey) {
+    memset(b, 0, sizeof(*b));
+    for (int i = 0; i < RDMA_POST_BATCH; i++) {
+        b->sge[i].lkey = lkey;                           // 本地 key
+        b->wr[i].sg_list = &b->sge[i];                   // 每个 WR 一个 SGE
+        b->wr[i].num_sge = 1;
+        b->wr[i].opcode = op;                            // Write / Write with Imm
+        b->wr[i].send_flags = IBV_SEND_SIGNALED;         // 请求完成事件
+        b->wr[i].wr.rdma.rkey = rkey;                    // 对端 rkey
+        b->wr[i].next = i + 1 < RDMA_POST_BATCH ? &b->wr[i + 1] : NULL;
+    }
+}
+
+// 批量投递：填一个块的可变字段
+int rdma_wr_batch_add(rdma_wr_batch_t *b, uint64_t addr, uint32_t len,
+                      uint64_t remote_addr, uint32_t imm, uint64_t wr_id) {
+    if (b->n == RDMA_POST_BATCH) {
+        return -1;
+    }
+    struct ibv_send_wr *wr = &b->wr[b->n];
+    b->sge[b->n].addr = addr;                            // 本地缓冲区地址
+    b->sge[b->n].length = len;                           // 写入长度
+    wr->wr_id = wr_id;
+    wr->wr.rdma.remote_addr = remote_addr;               // 对端地址
+    wr->imm_data = htonl(imm);                           // imm 在线上按网络字节序
+    return ++b->n;
+}
+
+// 批量投递：整条链一次 ibv_post_send
+int rdma_post_wr_batch(struct ibv_qp *qp, rdma_wr_batch_t *b) {
+    int n = b->n;
+    b->n = 0;
+    if (n == 0) {
+        return 0;
+    }
+    struct ibv_send_wr *last = &b->wr[n - 1];
+    struct ibv_send_wr *saved = last->next;
+    last->next = NULL;                                   // 链在第 n 个 WR 处结束
+    struct ibv_send_wr *bad = NULL;
+    int rc = ibv_post_send(qp, &b->wr[0], &bad);
+    last->next = saved;                                  // 恢复模板
+    if (rc != 0) {
+        return bad ? (int)(bad - &b->wr[0]) : 0;         // bad 之前的 WR 已经投递
+    }
+    return n;
+}
+
 // 轮询 CQ 等待完成事件
 // 说明：此 demo 使用主动轮询（polling）方式，逻辑简单但会消耗 CPU
 // 在真实系统中可用 comp_channel + eventfd 机制减少 CPU 占用
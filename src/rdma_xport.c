@@ -0,0 +1,454 @@
+﻿#include "rdma_xport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <ifaddrs.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+// 传输层分发
+// 说明：这里只做“按 kind 找操作表 + 参数整理”，具体行为在各后端实现
+// sender/receiver 只调用本文件导出的 rdma_ep_* / rdma_mem_* 接口
+
+static const rdma_xport_ops_t *xport_ops(rdma_xport_kind_t kind) {
+    switch (kind) {
+    case RDMA_XPORT_VERBS:
+        return &rdma_xport_verbs_ops;
+    case RDMA_XPORT_SHM:
+        return &rdma_xport_shm_ops;
+    case RDMA_XPORT_TCP:
+        return &rdma_xport_tcp_ops;
+    case RDMA_XPORT_AUTO:
+        break;
+    }
+    return NULL;
+}
+
+// AUTO 的尝试顺序：同机走共享内存，其次真实 RDMA，TCP 兜底
+// 监听端总是包含 shm（本机的发送端可能连过来）；发送端只有目的地址在本机时才尝试 shm
+static const rdma_xport_kind_t auto_order[] = { RDMA_XPORT_SHM, RDMA_XPORT_VERBS, RDMA_XPORT_TCP };
+#define AUTO_ORDER_N ((int)(sizeof(auto_order) / sizeof(auto_order[0])))
+
+static int same_addr(const struct sockaddr *a, const struct sockaddr *b) {
+    if (a->sa_family != b->sa_family) {
+        return 0;
+    }
+    if (a->sa_family == AF_INET) {
+        return ((const struct sockaddr_in *)a)->sin_addr.s_addr ==
+               ((const struct sockaddr_in *)b)->sin_addr.s_addr;
+    }
+    if (a->sa_family == AF_INET6) {
+        return memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr,
+                      &((const struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr)) == 0;
+    }
+    return 0;
+}
+
+// 目的地址是否在本机：回环地址，或本机某个网卡上的地址
+// 说明：只在当前网络命名空间内判断；shm 的抽象套接字同样按网络命名空间隔离
+static int is_local_host(const char *ip) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(ip, NULL, &hints, &res) != 0) {
+        return 0;
+    }
+    struct ifaddrs *ifs = NULL;
+    if (getifaddrs(&ifs) != 0) {
+        ifs = NULL;
+    }
+    int local = 0;
+    for (struct addrinfo *ai = res; ai && !local; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            const struct sockaddr_in *sin = (const struct sockaddr_in *)ai->ai_addr;
+            local = (ntohl(sin->sin_addr.s_addr) >> 24) == 127;     // 127.0.0.0/8
+        } else if (ai->ai_family == AF_INET6) {
+            local = IN6_IS_ADDR_LOOPBACK(&((const struct sockaddr_in6 *)ai->ai_addr)->sin6_addr);
+        }
+        for (struct ifaddrs *it = ifs; it && !local; it = it->ifa_next) {
+            local = it->ifa_addr && same_addr(ai->ai_addr, it->ifa_addr);
+        }
+    }
+    freeifaddrs(ifs);
+    freeaddrinfo(res);
+    return local;
+}
+
+// 解析 RDMA_SIM_TRANSPORT
+int rdma_xport_from_env(rdma_xport_kind_t *out_kind) {
+    const char *v = getenv("RDMA_SIM_TRANSPORT");
+    if (!v || !*v || strcmp(v, "auto") == 0) {
+        *out_kind = RDMA_XPORT_AUTO;                     // 默认：自动选择 + 回退
+        return 0;
+    }
+    if (strcmp(v, "verbs") == 0) {
+        *out_kind = RDMA_XPORT_VERBS;                    // 真实 verbs
+        return 0;
+    }
+    if (strcmp(v, "shm") == 0) {
+        *out_kind = RDMA_XPORT_SHM;                      // 共享内存模拟
+        return 0;
+    }
+    if (strcmp(v, "tcp") == 0) {
+        *out_kind = RDMA_XPORT_TCP;                      // TCP 回退
+        return 0;
+    }
+    fprintf(stderr, "unknown RDMA_SIM_TRANSPORT: %s\n", v);
+    return -1;
+}
+
+const char *rdma_xport_name(rdma_xport_kind_t kind) {
+    if (kind == RDMA_XPORT_AUTO) {
+        return "auto";
+    }
+    const rdma_xport_ops_t *ops = xport_ops(kind);
+    return ops ? ops->name : "unknown";
+}
+
+int rdma_ep_create(rdma_xport_kind_t kind, const char *ip, const char *port, rdma_ep_t **out_ep) {
+    if (kind == RDMA_XPORT_AUTO) {
+        // 依次尝试：对端不在本机时跳过 shm；没有 RDMA 设备时 verbs 会在 getaddrinfo / 建 QP 阶段失败；
+        // shm 在 create 阶段连不上本机的监听端也会失败
+        // 创建成功还要连得上才算数：混合部署时对端可能没有 verbs 监听（被拒绝 / 不可达），
+        // 所以每个候选都当场建连，失败就关掉换下一个（此时调用方还没注册任何内存）
+        int first = is_local_host(ip) ? 0 : 1;
+        for (int i = first; i < AUTO_ORDER_N; i++) {
+            rdma_ep_t *ep = NULL;
+            if (rdma_ep_create(auto_order[i], ip, port, &ep) == 0) {
+                if (rdma_ep_connect(ep) == 0) {
+                    *out_ep = ep;
+                    return 0;
+                }
+                rdma_ep_close(ep);
+            }
+            if (i + 1 < AUTO_ORDER_N) {
+                fprintf(stderr, "[xport] %s unavailable, falling back to %s\n",
+                        rdma_xport_name(auto_order[i]), rdma_xport_name(auto_order[i + 1]));
+            }
+        }
+        return -1;
+    }
+    const rdma_xport_ops_t *ops = xport_ops(kind);
+    if (!ops) {
+        return -1;
+    }
+    rdma_ep_t *ep = (rdma_ep_t *)calloc(1, sizeof(*ep));
+    if (!ep) {
+        return -1;
+    }
+    ep->ops = ops;
+    ep->kind = kind;
+    ep->max_sge = 1;
+    if (ops->create(ep, ip, port) != 0) {
+        free(ep);
+        return -1;
+    }
+    *out_ep = ep;
+    return 0;
+}
+
+int rdma_ep_connect(rdma_ep_t *ep) {
+    if (ep->connected) {
+        return 0;                                        // AUTO 已在 create 中建连
+    }
+    if (ep->ops->connect(ep) != 0) {
+        return -1;
+    }
+    ep->connected = 1;
+    return 0;
+}
+
+// AUTO：在每个可用后端上各建一个子监听端点
+static int listener_create_auto(const char *ip, const char *port, rdma_listener_t **out_ln) {
+    rdma_listener_t *ln = (rdma_listener_t *)calloc(1, sizeof(*ln));
+    if (!ln) {
+        return -1;
+    }
+    ln->kind = RDMA_XPORT_AUTO;
+    for (int i = 0; i < AUTO_ORDER_N; i++) {
+        rdma_listener_t *sub = NULL;
+        if (rdma_listener_create(auto_order[i], ip, port, &sub) == 0) {
+            ln->subs[ln->nsubs++] = sub;
+        } else if (errno == EADDRINUSE) {
+            // 地址被别的接收端占着不是“后端不可用”：少了这个监听端，
+            // 发给本端的连接会落到那个接收端，所以整体失败
+            fprintf(stderr, "[xport] %s address %s:%s in use\n", rdma_xport_name(auto_order[i]), ip, port);
+            for (int k = 0; k < ln->nsubs; k++) {
+                rdma_listener_close(ln->subs[k]);
+            }
+            free(ln);
+            return -1;
+        } else {
+            fprintf(stderr, "[xport] %s listener unavailable\n", rdma_xport_name(auto_order[i]));
+        }
+    }
+    if (ln->nsubs == 0) {
+        free(ln);
+        return -1;
+    }
+    *out_ln = ln;
+    return 0;
+}
+
+int rdma_listener_create(rdma_xport_kind_t kind, const char *ip, const char *port, rdma_listener_t **out_ln) {
+    if (kind == RDMA_XPORT_AUTO) {
+        return listener_create_auto(ip, port, out_ln);
+    }
+    const rdma_xport_ops_t *ops = xport_ops(kind);
+    if (!ops) {
+        return -1;
+    }
+    rdma_listener_t *ln = (rdma_listener_t *)calloc(1, sizeof(*ln));
+    if (!ln) {
+        return -1;
+    }
+    ln->ops = ops;
+    ln->kind = kind;
+    if (ops->listen(ln, ip, port) != 0) {
+        free(ln);
+        return -1;
+    }
+    *out_ln = ln;
+    return 0;
+}
+
+int rdma_listener_get_request(rdma_listener_t *ln, rdma_ep_t **out_ep) {
+    if (ln->nsubs > 0) {
+        // AUTO：同时等待各子监听端点，哪个先有连接请求就交给哪个
+        struct pollfd pfd[RDMA_XPORT_AUTO];
+        for (int i = 0; i < ln->nsubs; i++) {
+            pfd[i].fd = ln->subs[i]->ops->listen_fd(ln->subs[i]);
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+        }
+        while (1) {
+            int n = poll(pfd, (nfds_t)ln->nsubs, -1);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return -1;
+            }
+            for (int i = 0; i < ln->nsubs; i++) {
+                if (pfd[i].revents & POLLIN) {
+                    return rdma_listener_get_request(ln->subs[i], out_ep);
+                }
+            }
+        }
+    }
+    rdma_ep_t *ep = (rdma_ep_t *)calloc(1, sizeof(*ep));
+    if (!ep) {
+        return -1;
+    }
+    ep->ops = ln->ops;
+    ep->kind = ln->kind;
+    ep->max_sge = 1;
+    if (ln->ops->get_request(ln, ep) != 0) {
+        free(ep);
+        return -1;
+    }
+    *out_ep = ep;
+    return 0;
+}
+
+int rdma_ep_accept(rdma_ep_t *ep) {
+    return ep->ops->accept(ep);
+}
+
+void rdma_listener_close(rdma_listener_t *ln) {
+    if (!ln) {
+        return;
+    }
+    for (int i = 0; i < ln->nsubs; i++) {
+        rdma_listener_close(ln->subs[i]);
+    }
+    if (ln->ops) {
+        ln->ops->close_listener(ln);
+    }
+    free(ln);
+}
+
+void rdma_ep_close(rdma_ep_t *ep) {
+    if (!ep) {
+        return;
+    }
+    ep->ops->close(ep);
+    free(ep);
+}
+
+int rdma_ep_max_sge(rdma_ep_t *ep) {
+    return ep->max_sge;
+}
+
+rdma_xport_kind_t rdma_ep_kind(rdma_ep_t *ep) {
+    return ep->kind;
+}
+
+int rdma_mem_reg(rdma_ep_t *ep, void *buf, size_t len, int access, rdma_mem_t *out_mem) {
+    memset(out_mem, 0, sizeof(*out_mem));
+    out_mem->fd = -1;
+    return ep->ops->mem_reg(ep, buf, len, access, out_mem);
+}
+
+int rdma_mem_alloc(rdma_ep_t *ep, size_t len, int access, rdma_mem_t *out_mem) {
+    memset(out_mem, 0, sizeof(*out_mem));
+    out_mem->fd = -1;
+    if (len == 0) {
+        len = 1;                                         // 空文件也要一块合法内存
+    }
+    return ep->ops->mem_alloc(ep, len, access, out_mem);
+}
+
+// 源文件：映射后注册（不读入用户态缓冲区）
+int rdma_mem_reg_file(rdma_ep_t *ep, int fd, size_t len, int access, rdma_mem_t *out_mem) {
+    memset(out_mem, 0, sizeof(*out_mem));
+    size_t map_len = len ? len : 1;                      // 空文件也映射一页，不会被访问
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap source file");
+        return -1;
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);              // 顺序读，提示内核加大预读
+    int rc = ep->ops->mem_reg_file ? ep->ops->mem_reg_file(ep, fd, map, map_len, access, out_mem)
+                                   : ep->ops->mem_reg(ep, map, map_len, access, out_mem);
+    if (rc != 0) {
+        munmap(map, map_len);
+        return -1;
+    }
+    out_mem->fd = fd;
+    out_mem->flags |= RDMA_MEM_F_MAPPED;
+    return 0;
+}
+
+// 目的文件：后端支持直接落盘则交给后端，否则先收进内存，flush 时写回
+int rdma_mem_alloc_file(rdma_ep_t *ep, int fd, size_t len, int access, rdma_mem_t *out_mem) {
+    if (ftruncate(fd, (off_t)len) != 0) {
+        perror("ftruncate");
+        return -1;
+    }
+    int rc;
+    if (ep->ops->mem_alloc_file) {
+        memset(out_mem, 0, sizeof(*out_mem));
+        rc = ep->ops->mem_alloc_file(ep, fd, len ? len : 1, access, out_mem);
+        out_mem->flags |= RDMA_MEM_F_DIRECT;
+    } else {
+        rc = rdma_mem_alloc(ep, len, access, out_mem);
+    }
+    if (rc != 0) {
+        return -1;
+    }
+    out_mem->fd = fd;
+    out_mem->flags |= RDMA_MEM_F_FILE_DST;
+    return 0;
+}
+
+int rdma_mem_flush(rdma_ep_t *ep, rdma_mem_t *mem) {
+    (void)ep;
+    if (!(mem->flags & RDMA_MEM_F_FILE_DST) || (mem->flags & RDMA_MEM_F_DIRECT)) {
+        return 0;                                        // 数据已在文件里
+    }
+    struct stat st;
+    if (fstat(mem->fd, &st) != 0) {
+        return -1;
+    }
+    size_t len = (size_t)st.st_size < mem->length ? (size_t)st.st_size : mem->length;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(mem->fd, (uint8_t *)mem->addr + done, len - done, (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("pwrite");
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+void rdma_mem_dereg(rdma_ep_t *ep, rdma_mem_t *mem) {
+    if (!mem || !mem->priv) {
+        return;
+    }
+    ep->ops->mem_dereg(ep, mem);
+    if (mem->flags & RDMA_MEM_F_MAPPED) {
+        munmap(mem->addr, mem->length);
+    }
+    memset(mem, 0, sizeof(*mem));
+}
+
+// 把 (buf, len, mem) 组装成单个 SGE
+static void make_sge(struct ibv_sge *sge, void *buf, size_t len, rdma_mem_t *mem) {
+    memset(sge, 0, sizeof(*sge));
+    sge->addr = (uintptr_t)buf;
+    sge->length = (uint32_t)len;
+    sge->lkey = mem->lkey;
+}
+
+int rdma_ep_post_recv(rdma_ep_t *ep, void *buf, size_t len, rdma_mem_t *mem, uint64_t wr_id) {
+    struct ibv_sge sge;
+    make_sge(&sge, buf, len, mem);
+    return ep->ops->post_recv(ep, &sge, wr_id);
+}
+
+int rdma_ep_post_send(rdma_ep_t *ep, void *buf, size_t len, rdma_mem_t *mem, uint64_t wr_id) {
+    struct ibv_sge sge;
+    make_sge(&sge, buf, len, mem);
+    return ep->ops->post_send(ep, &sge, 1, wr_id);
+}
+
+int rdma_ep_post_write(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge,
+                       uint64_t remote_addr, uint32_t rkey, uint64_t wr_id) {
+    if (num_sge < 1 || num_sge > ep->max_sge) {
+        return -1;
+    }
+    return ep->ops->post_rdma(ep, IBV_WR_RDMA_WRITE, sge, num_sge, remote_addr, rkey, 0, wr_id);
+}
+
+int rdma_ep_post_write_imm(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge,
+                           uint64_t remote_addr, uint32_t rkey, uint32_t imm, uint64_t wr_id) {
+    if (num_sge < 1 || num_sge > ep->max_sge) {
+        return -1;
+    }
+    return ep->ops->post_rdma(ep, IBV_WR_RDMA_WRITE_WITH_IMM, sge, num_sge, remote_addr, rkey, imm, wr_id);
+}
+
+int rdma_ep_post_read(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge,
+                      uint64_t remote_addr, uint32_t rkey, uint64_t wr_id) {
+    if (num_sge < 1 || num_sge > ep->max_sge) {
+        return -1;
+    }
+    return ep->ops->post_rdma(ep, IBV_WR_RDMA_READ, sge, num_sge, remote_addr, rkey, 0, wr_id);
+}
+
+int rdma_ep_post_batch(rdma_ep_t *ep, rdma_wr_batch_t *b) {
+    if (ep->ops->post_batch) {
+        return ep->ops->post_batch(ep, b);
+    }
+    int n = b->n;
+    b->n = 0;
+    for (int i = 0; i < n; i++) {
+        struct ibv_send_wr *wr = &b->wr[i];
+        if (ep->ops->post_rdma(ep, wr->opcode, wr->sg_list, wr->num_sge, wr->wr.rdma.remote_addr,
+                               wr->wr.rdma.rkey, ntohl(wr->imm_data), wr->wr_id) != 0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+int rdma_ep_poll(rdma_ep_t *ep, struct ibv_wc *wc, int max) {
+    return ep->ops->poll(ep, wc, max);
+}
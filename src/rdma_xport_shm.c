@@ -0,0 +1,552 @@
+﻿#define _GNU_SOURCE
+#include "rdma_xport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// 共享内存后端：在同一台机器的两个进程之间模拟 verbs 语义
+// 用途：没有 RDMA 设备（容器里加载不了 rdma_rxe）时跑通 sender/receiver 与基准测试
+//
+// 模拟方式：
+// - 建连：抽象命名空间的 Unix 域套接字 "@rdma_sim.shm.<ip>.<port>"（IP 规范化后的文本）
+//   监听 0.0.0.0 / :: 时用通配名 "@rdma_sim.shm.*.<port>"，发送端先连精确名、再连通配名
+//   发送端在 create 阶段就连上监听端，连不上即返回失败，AUTO 据此判断对端是否在本机
+// - MR：rdma_mem_alloc 用 memfd 分配内存；需要远端访问的 MR 通过 SCM_RIGHTS
+//   把 fd 连同 addr/rkey/length 发给对端，对端 mmap 后按 rkey 建表
+// - 目的文件：rdma_mem_alloc_file 直接导出输出文件本身，对端的 Write 直接拷进页缓存，
+//   不经过中间缓冲区，也不需要 flush 时再 pwrite
+// - RDMA Write/Read：发起方直接在映射上 memcpy（单边，对端 CPU 不参与）
+// - Send/Recv、Write with Imm、CQ：软件 QP（rdma_xport_sw.c）
+//
+// 延迟/带宽模型（环境变量，默认不限速）：
+// - RDMA_SIM_SHM_LAT_US：单次操作的单向延迟（微秒）
+// - RDMA_SIM_SHM_BW_MBPS：链路带宽（MB/s），操作按链路串行排队
+// 完成事件带“最早可见时间”，poll 只交付已到期的事件
+
+// 对端导出的内存（已映射到本进程）
+typedef struct {
+    uint32_t rkey;
+    uint64_t addr;                        // 对端虚拟地址（remote_addr 以此为基准）
+    uint64_t len;
+    int access;
+    uint8_t *map;                         // 本进程中的映射
+} shm_peer_mr_t;
+
+typedef struct {
+    sw_qp_t qp;                           // 软件 QP
+    char name[108];                       // 抽象套接字名（不含开头的 '\0'）
+
+    shm_peer_mr_t *peer;
+    int npeer;
+    int cap_peer;
+
+    uint64_t lat_ns;                      // 单向延迟
+    double bw_bytes_per_ns;               // 带宽（0 表示不限）
+    uint64_t link_free_ns;                // 链路空闲时刻
+} shm_ep_t;
+
+typedef struct {
+    int fd;
+    char name[108];
+} shm_listener_t;
+
+static shm_ep_t *sep(rdma_ep_t *ep) {
+    return (shm_ep_t *)ep->priv;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// 计算一次传输的完成时刻：链路串行排队 + 传输时间 + 单向延迟
+static uint64_t model_ready(shm_ep_t *s, uint64_t bytes) {
+    if (s->lat_ns == 0 && s->bw_bytes_per_ns <= 0) {
+        return 0;                                           // 未配置模型：立即可见
+    }
+    uint64_t now = now_ns();
+    uint64_t start = s->link_free_ns > now ? s->link_free_ns : now;
+    uint64_t xfer = s->bw_bytes_per_ns > 0 ? (uint64_t)((double)bytes / s->bw_bytes_per_ns) : 0;
+    s->link_free_ns = start + xfer;
+    return s->link_free_ns + s->lat_ns;
+}
+
+static void load_model(shm_ep_t *s) {
+    const char *lat = getenv("RDMA_SIM_SHM_LAT_US");
+    const char *bw = getenv("RDMA_SIM_SHM_BW_MBPS");
+    if (lat && *lat) {
+        s->lat_ns = (uint64_t)(atof(lat) * 1000.0);
+    }
+    if (bw && *bw) {
+        s->bw_bytes_per_ns = atof(bw) * 1e6 / 1e9;          // MB/s -> 字节/纳秒
+    }
+}
+
+// 由监听 / 目的地址得到套接字名：同一地址的不同写法（主机名、IPv6 缩写）得到同一个名字，
+// 通配地址（或未给出地址）得到 "*"；解析失败时按原文
+static void shm_name(const char *ip, const char *port, char *out, size_t cap) {
+    char host[INET6_ADDRSTRLEN];
+    snprintf(host, sizeof(host), "%s", ip && *ip ? ip : "*");
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res = NULL;
+    if (ip && *ip && getaddrinfo(ip, NULL, &hints, &res) == 0) {
+        if (res->ai_family == AF_INET) {
+            const struct in_addr *a = &((const struct sockaddr_in *)res->ai_addr)->sin_addr;
+            if (a->s_addr == htonl(INADDR_ANY)) {
+                snprintf(host, sizeof(host), "*");
+            } else {
+                inet_ntop(AF_INET, a, host, sizeof(host));
+            }
+        } else if (res->ai_family == AF_INET6) {
+            const struct in6_addr *a = &((const struct sockaddr_in6 *)res->ai_addr)->sin6_addr;
+            if (IN6_IS_ADDR_UNSPECIFIED(a)) {
+                snprintf(host, sizeof(host), "*");
+            } else {
+                inet_ntop(AF_INET6, a, host, sizeof(host));
+            }
+        }
+        freeaddrinfo(res);
+    }
+    snprintf(out, cap, "rdma_sim.shm.%s.%s", host, port);
+}
+
+static void shm_addr(const char *name, struct sockaddr_un *sun, socklen_t *len) {
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    size_t n = strlen(name);
+    memcpy(sun->sun_path + 1, name, n);                     // sun_path[0] = '\0'：抽象命名空间
+    *len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+static shm_peer_mr_t *find_peer(shm_ep_t *s, uint32_t rkey) {
+    for (int i = 0; i < s->npeer; i++) {
+        if (s->peer[i].rkey == rkey) {
+            return &s->peer[i];
+        }
+    }
+    return NULL;
+}
+
+static int add_peer_mr(shm_ep_t *s, const sw_msg_t *hdr, int fd) {
+    if (fd < 0) {
+        return -1;
+    }
+    uint8_t *map = (uint8_t *)mmap(NULL, (size_t)hdr->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);                                              // 映射建立后 fd 可关闭
+    if (map == MAP_FAILED) {
+        perror("shm: mmap peer MR");
+        return -1;
+    }
+    if (s->npeer == s->cap_peer) {
+        int cap = s->cap_peer ? s->cap_peer * 2 : 16;
+        shm_peer_mr_t *p = (shm_peer_mr_t *)realloc(s->peer, (size_t)cap * sizeof(*p));
+        if (!p) {
+            munmap(map, (size_t)hdr->length);
+            return -1;
+        }
+        s->peer = p;
+        s->cap_peer = cap;
+    }
+    shm_peer_mr_t *m = &s->peer[s->npeer++];
+    m->rkey = hdr->rkey;
+    m->addr = hdr->addr;
+    m->len = hdr->length;
+    m->access = (int)hdr->access;
+    m->map = map;
+    return 0;
+}
+
+static void del_peer_mr(shm_ep_t *s, uint32_t rkey) {
+    for (int i = 0; i < s->npeer; i++) {
+        if (s->peer[i].rkey == rkey) {
+            munmap(s->peer[i].map, (size_t)s->peer[i].len);
+            s->peer[i] = s->peer[--s->npeer];
+            return;
+        }
+    }
+}
+
+// 软件 QP 回调：处理 MR 导出/撤销
+static int shm_on_msg(sw_qp_t *q, const sw_msg_t *hdr, int fd) {
+    shm_ep_t *s = (shm_ep_t *)q->ctx;
+    switch (hdr->type) {
+    case SW_MSG_MR:
+        return add_peer_mr(s, hdr, fd);
+    case SW_MSG_DEREG:
+        del_peer_mr(s, hdr->rkey);
+        return 0;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+// 把一个需要远端访问的 MR 导出给对端
+static int export_mr(shm_ep_t *s, sw_mr_t *mr) {
+    sw_msg_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = SW_MSG_MR;
+    hdr.rkey = mr->key;
+    hdr.addr = (uint64_t)(uintptr_t)mr->addr;
+    hdr.length = mr->len;
+    hdr.access = (uint32_t)mr->access;
+    if (sw_send_msg(&s->qp, &hdr, NULL, 0, mr->fd) != 0) {
+        return -1;
+    }
+    mr->exported = 1;
+    return 0;
+}
+
+// 建连时导出之前分配的 MR（MR 表只在调用线程修改，这里可直接遍历）
+static int export_all(shm_ep_t *s) {
+    for (int i = 0; i < s->qp.nmrs; i++) {
+        sw_mr_t *mr = &s->qp.mrs[i];
+        if (mr->fd >= 0 && !mr->exported &&
+            (mr->access & (IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ)) &&
+            export_mr(s, mr) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static shm_ep_t *new_ep(rdma_ep_t *ep) {
+    shm_ep_t *s = (shm_ep_t *)calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    if (sw_qp_init(&s->qp) != 0) {
+        free(s);
+        return NULL;
+    }
+    s->qp.on_msg = shm_on_msg;
+    s->qp.ctx = s;
+    load_model(s);
+    ep->priv = s;
+    ep->max_sge = RDMA_MAX_SGE;
+    return s;
+}
+
+static void free_ep(rdma_ep_t *ep) {
+    shm_ep_t *s = sep(ep);
+    sw_qp_destroy(&s->qp);
+    free(s);
+    ep->priv = NULL;
+}
+
+// 连接指定名字的监听端，成功返回 0
+static int shm_dial(shm_ep_t *s, const char *name) {
+    struct sockaddr_un sun;
+    socklen_t len;
+    shm_addr(name, &sun, &len);
+    if (connect(s->qp.sock, (struct sockaddr *)&sun, len) != 0) {
+        return -1;
+    }
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    return 0;
+}
+
+static int shm_create(rdma_ep_t *ep, const char *ip, const char *port) {
+    shm_ep_t *s = new_ep(ep);
+    if (!s) {
+        return -1;
+    }
+
+    // 先连上套接字（相当于 verbs 的地址/路由解析）：本机没有对应的监听端就在这里失败
+    // 先找监听在该地址上的，再找监听通配地址的（与 TCP 的匹配顺序一致）
+    s->qp.sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s->qp.sock < 0) {
+        perror("shm: socket");
+        free_ep(ep);
+        return -1;
+    }
+    char name[sizeof(s->name)];
+    char any[sizeof(s->name)];
+    shm_name(ip, port, name, sizeof(name));
+    shm_name(NULL, port, any, sizeof(any));
+    if (shm_dial(s, name) != 0 && (strcmp(name, any) == 0 || shm_dial(s, any) != 0)) {
+        perror("shm: connect");
+        free_ep(ep);
+        return -1;
+    }
+    return 0;
+}
+
+static int shm_connect(rdma_ep_t *ep) {
+    shm_ep_t *s = sep(ep);
+    s->qp.connected = 1;
+    return export_all(s);
+}
+
+static int shm_listen(rdma_listener_t *ln, const char *ip, const char *port) {
+    shm_listener_t *l = (shm_listener_t *)calloc(1, sizeof(*l));
+    if (!l) {
+        return -1;
+    }
+    shm_name(ip, port, l->name, sizeof(l->name));
+    l->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (l->fd < 0) {
+        perror("shm: socket");
+        free(l);
+        return -1;
+    }
+    struct sockaddr_un sun;
+    socklen_t len;
+    shm_addr(l->name, &sun, &len);
+    if (bind(l->fd, (struct sockaddr *)&sun, len) != 0 || listen(l->fd, 16) != 0) {
+        int err = errno;                                    // 保留给调用方（AUTO 要区分地址被占用）
+        perror("shm: bind/listen");
+        close(l->fd);
+        free(l);
+        errno = err;
+        return -1;
+    }
+    ln->priv = l;
+    return 0;
+}
+
+static int shm_get_request(rdma_listener_t *ln, rdma_ep_t *ep) {
+    shm_listener_t *l = (shm_listener_t *)ln->priv;
+    shm_ep_t *s = new_ep(ep);
+    if (!s) {
+        return -1;
+    }
+    memcpy(s->name, l->name, sizeof(s->name));
+    do {
+        s->qp.sock = accept4(l->fd, NULL, NULL, SOCK_CLOEXEC);
+    } while (s->qp.sock < 0 && errno == EINTR);
+    if (s->qp.sock < 0) {
+        perror("shm: accept");
+        free_ep(ep);
+        return -1;
+    }
+    return 0;
+}
+
+static int shm_accept(rdma_ep_t *ep) {
+    shm_ep_t *s = sep(ep);
+    s->qp.connected = 1;
+    return export_all(s);
+}
+
+static void shm_close_listener(rdma_listener_t *ln) {
+    shm_listener_t *l = (shm_listener_t *)ln->priv;
+    if (!l) {
+        return;
+    }
+    close(l->fd);
+    free(l);
+    ln->priv = NULL;
+}
+
+static int shm_listen_fd(rdma_listener_t *ln) {
+    return ((shm_listener_t *)ln->priv)->fd;
+}
+
+static int shm_mem_reg(rdma_ep_t *ep, void *buf, size_t len, int access, rdma_mem_t *mem) {
+    if (access & (IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ)) {
+        // 普通内存无法映射给另一个进程
+        fprintf(stderr, "shm: remote access requires rdma_mem_alloc\n");
+        return -1;
+    }
+    sw_mr_t *mr = sw_mr_add(&sep(ep)->qp, (uint8_t *)buf, len, access, -1);
+    if (!mr) {
+        return -1;
+    }
+    sw_fill_mem(mem, mr);
+    return 0;
+}
+
+// 映射 fd 并登记为可导出的 MR；成功后 fd 归 MR 表所有，失败时由这里关闭
+static int add_shared_mr(shm_ep_t *s, int fd, size_t len, int access, rdma_mem_t *mem) {
+    uint8_t *addr = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        perror("shm: mmap");
+        close(fd);
+        return -1;
+    }
+    sw_mr_t *mr = sw_mr_add(&s->qp, addr, len, access, fd);
+    if (!mr) {
+        munmap(addr, len);
+        close(fd);
+        return -1;
+    }
+    // 已连接则立即导出，否则在 connect/accept 时统一导出
+    if (s->qp.connected && (access & (IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ)) &&
+        export_mr(s, mr) != 0) {
+        fprintf(stderr, "shm: export MR failed\n");
+        sw_mr_del(&s->qp, mr->key);
+        munmap(addr, len);
+        close(fd);
+        return -1;
+    }
+    sw_fill_mem(mem, mr);
+    return 0;
+}
+
+static int shm_mem_alloc(rdma_ep_t *ep, size_t len, int access, rdma_mem_t *mem) {
+    int fd = memfd_create("rdma_sim", MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("shm: memfd_create");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)len) != 0) {
+        perror("shm: ftruncate");
+        close(fd);
+        return -1;
+    }
+    if (add_shared_mr(sep(ep), fd, len, access, mem) != 0) {
+        return -1;
+    }
+    mem->owned = 1;
+    return 0;
+}
+
+// 目的文件：导出输出文件本身（长度已由 rdma_mem_alloc_file 设好）
+static int shm_mem_alloc_file(rdma_ep_t *ep, int fd, size_t len, int access, rdma_mem_t *mem) {
+    int dfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);                // MR 持有自己的副本，注销时关闭
+    if (dfd < 0) {
+        perror("shm: dup");
+        return -1;
+    }
+    return add_shared_mr(sep(ep), dfd, len, access, mem);
+}
+
+static void shm_mem_dereg(rdma_ep_t *ep, rdma_mem_t *mem) {
+    shm_ep_t *s = sep(ep);
+    uint32_t key = (uint32_t)(uintptr_t)mem->priv;
+    sw_mr_t mr;
+    if (sw_mr_lookup(&s->qp, key, &mr) != 0) {
+        return;
+    }
+    if (mr.exported && s->qp.connected && !s->qp.peer_closed) {
+        sw_msg_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.type = SW_MSG_DEREG;
+        hdr.rkey = key;
+        sw_send_msg(&s->qp, &hdr, NULL, 0, -1);             // 尽力通知，失败无妨
+    }
+    if (mr.fd >= 0) {
+        munmap(mr.addr, mr.len);
+        close(mr.fd);
+    }
+    sw_mr_del(&s->qp, key);
+}
+
+static int shm_post_recv(rdma_ep_t *ep, struct ibv_sge *sge, uint64_t wr_id) {
+    return sw_post_recv(&sep(ep)->qp, sge, wr_id);
+}
+
+static int shm_post_send(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge, uint64_t wr_id) {
+    shm_ep_t *s = sep(ep);
+    uint64_t total = 0;
+    for (int i = 0; i < num_sge; i++) {
+        total += sge[i].length;
+    }
+    return sw_post_send(&s->qp, sge, num_sge, wr_id, model_ready(s, total), NULL);
+}
+
+static int shm_post_rdma(rdma_ep_t *ep, enum ibv_wr_opcode op, struct ibv_sge *sge, int num_sge,
+                         uint64_t remote_addr, uint32_t rkey, uint32_t imm, uint64_t wr_id) {
+    shm_ep_t *s = sep(ep);
+    if (!s->qp.connected || s->qp.peer_closed) {
+        return -1;
+    }
+    // 先处理已到达的消息，确保对端新导出的 MR 已建表
+    if (sw_progress(&s->qp) < 0) {
+        return -1;
+    }
+    enum ibv_wc_opcode wc_op = op == IBV_WR_RDMA_READ ? IBV_WC_RDMA_READ : IBV_WC_RDMA_WRITE;
+    uint64_t total = 0;
+    if (sw_check_sges(&s->qp, sge, num_sge, &total) != 0) {
+        return sw_cq_push(&s->qp, wr_id, wc_op, IBV_WC_LOC_PROT_ERR, 0, 0, 0, 0);
+    }
+    int need = op == IBV_WR_RDMA_READ ? IBV_ACCESS_REMOTE_READ : IBV_ACCESS_REMOTE_WRITE;
+    shm_peer_mr_t *pm = find_peer(s, rkey);
+    if (!pm || !(pm->access & need) || remote_addr < pm->addr ||
+        remote_addr + total > pm->addr + pm->len) {
+        // rkey 无效 / 越界 / 权限不足：与 verbs 一样以错误完成事件报告
+        return sw_cq_push(&s->qp, wr_id, wc_op, IBV_WC_REM_ACCESS_ERR, 0, 0, 0, 0);
+    }
+
+    // 单边操作：直接在对端映射上拷贝
+    uint8_t *remote = pm->map + (remote_addr - pm->addr);
+    for (int i = 0; i < num_sge; i++) {
+        void *local = (void *)(uintptr_t)sge[i].addr;
+        if (op == IBV_WR_RDMA_READ) {
+            memcpy(local, remote, sge[i].length);
+        } else {
+            memcpy(remote, local, sge[i].length);
+        }
+        remote += sge[i].length;
+    }
+
+    uint64_t ready = model_ready(s, total);
+    if (op == IBV_WR_RDMA_READ && ready) {
+        ready += s->lat_ns;                                 // 读需要一个来回
+    }
+    if (op == IBV_WR_RDMA_WRITE_WITH_IMM &&
+        sw_send_imm(&s->qp, (uint32_t)total, imm, ready, NULL) != 0) {
+        return -1;
+    }
+    return sw_cq_push(&s->qp, wr_id, wc_op, IBV_WC_SUCCESS, (uint32_t)total, 0, 0, ready);
+}
+
+static int shm_poll(rdma_ep_t *ep, struct ibv_wc *wc, int max) {
+    return sw_poll(&sep(ep)->qp, wc, max);
+}
+
+static void shm_close(rdma_ep_t *ep) {
+    shm_ep_t *s = sep(ep);
+    if (!s) {
+        return;
+    }
+    for (int i = 0; i < s->npeer; i++) {
+        munmap(s->peer[i].map, (size_t)s->peer[i].len);
+    }
+    for (int i = 0; i < s->qp.nmrs; i++) {
+        if (s->qp.mrs[i].fd >= 0) {
+            close(s->qp.mrs[i].fd);                         // 映射由 rdma_mem_dereg 负责
+        }
+    }
+    free(s->peer);
+    free_ep(ep);
+}
+
+const rdma_xport_ops_t rdma_xport_shm_ops = {
+    .name = "shm",
+    .create = shm_create,
+    .connect = shm_connect,
+    .listen = shm_listen,
+    .get_request = shm_get_request,
+    .accept = shm_accept,
+    .close_listener = shm_close_listener,
+    .listen_fd = shm_listen_fd,
+    .mem_reg = shm_mem_reg,
+    .mem_alloc = shm_mem_alloc,
+    .mem_dereg = shm_mem_dereg,
+    .mem_alloc_file = shm_mem_alloc_file,
+    .post_recv = shm_post_recv,
+    .post_send = shm_post_send,
+    .post_rdma = shm_post_rdma,
+    .poll = shm_poll,
+    .close = shm_close,
+};
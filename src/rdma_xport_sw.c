@@ -0,0 +1,427 @@
+﻿#include "rdma_xport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+// 软件 QP：shm / tcp 后端共用的 verbs 语义实现
+// - Recv 队列：post_recv 入队，到达的 SEND / WRITE_IMM 按 FIFO 消费
+// - 未匹配消息：对端先发、本端还没挂 Recv 时暂存（相当于 RNR 无限重试）
+// - fence：消息携带“发送前每条数据流已投递的字节数”，本端各流落位都追上后才交付，
+//   保证“先写数据、后发 FIN”的顺序在多路数据流下依然成立
+//   （按流分道计数：单条流内有序，多个 Write 并发在途时总字节数会被后面的 Write 凑够）
+// - CQ：环形队列，带最早可见时间（shm 的延迟/带宽模型用）
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int sw_qp_init(sw_qp_t *q) {
+    memset(q, 0, sizeof(*q));
+    q->sock = -1;
+    q->next_key = 1;
+    if (pthread_mutex_init(&q->cq_lock, NULL) != 0) {
+        return -1;
+    }
+    if (pthread_mutex_init(&q->mr_lock, NULL) != 0) {
+        pthread_mutex_destroy(&q->cq_lock);
+        return -1;
+    }
+    return 0;
+}
+
+void sw_qp_destroy(sw_qp_t *q) {
+    if (q->sock >= 0) {
+        close(q->sock);
+        q->sock = -1;
+    }
+    while (q->pend_head != q->pend_tail) {
+        free(q->pend[q->pend_head % SW_RQ_DEPTH].payload);
+        q->pend_head++;
+    }
+    free(q->mrs);
+    q->mrs = NULL;
+    pthread_mutex_destroy(&q->mr_lock);
+    pthread_mutex_destroy(&q->cq_lock);
+}
+
+sw_mr_t *sw_mr_add(sw_qp_t *q, uint8_t *addr, size_t len, int access, int fd) {
+    sw_mr_t *mr = NULL;
+    pthread_mutex_lock(&q->mr_lock);
+    if (q->nmrs == q->cap_mrs) {
+        int cap = q->cap_mrs ? q->cap_mrs * 2 : 16;
+        sw_mr_t *m = (sw_mr_t *)realloc(q->mrs, (size_t)cap * sizeof(*m));
+        if (!m) {
+            pthread_mutex_unlock(&q->mr_lock);
+            return NULL;
+        }
+        q->mrs = m;
+        q->cap_mrs = cap;
+    }
+    mr = &q->mrs[q->nmrs++];
+    memset(mr, 0, sizeof(*mr));
+    mr->key = q->next_key++;
+    mr->addr = addr;
+    mr->len = len;
+    mr->access = access;
+    mr->fd = fd;
+    pthread_mutex_unlock(&q->mr_lock);
+    return mr;                                              // 仅供调用线程立即使用
+}
+
+int sw_mr_lookup(sw_qp_t *q, uint32_t key, sw_mr_t *out) {
+    int rc = -1;
+    pthread_mutex_lock(&q->mr_lock);
+    for (int i = 0; i < q->nmrs; i++) {
+        if (q->mrs[i].key == key) {
+            *out = q->mrs[i];
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&q->mr_lock);
+    return rc;
+}
+
+void sw_mr_del(sw_qp_t *q, uint32_t key) {
+    pthread_mutex_lock(&q->mr_lock);
+    for (int i = 0; i < q->nmrs; i++) {
+        if (q->mrs[i].key == key) {
+            q->mrs[i] = q->mrs[--q->nmrs];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&q->mr_lock);
+}
+
+void sw_fill_mem(rdma_mem_t *mem, const sw_mr_t *mr) {
+    mem->addr = mr->addr;
+    mem->length = mr->len;
+    mem->lkey = mr->key;
+    mem->rkey = mr->key;
+    mem->priv = (void *)(uintptr_t)mr->key;                 // 注销时按 key 查找
+}
+
+// 校验本地 SGE 落在 lkey 对应的 MR 内
+int sw_check_sges(sw_qp_t *q, const struct ibv_sge *sge, int num_sge, uint64_t *out_total) {
+    uint64_t total = 0;
+    for (int i = 0; i < num_sge; i++) {
+        sw_mr_t mr;
+        if (sw_mr_lookup(q, sge[i].lkey, &mr) != 0) {
+            return -1;
+        }
+        uint64_t base = (uint64_t)(uintptr_t)mr.addr;
+        if (sge[i].addr < base || sge[i].addr + sge[i].length > base + mr.len) {
+            return -1;
+        }
+        total += sge[i].length;
+    }
+    *out_total = total;
+    return 0;
+}
+
+int sw_cq_push(sw_qp_t *q, uint64_t wr_id, enum ibv_wc_opcode op, enum ibv_wc_status status,
+               uint32_t byte_len, uint32_t imm, int with_imm, uint64_t ready_ns) {
+    int rc = 0;
+    pthread_mutex_lock(&q->cq_lock);
+    if (q->cq_tail - q->cq_head == SW_CQ_DEPTH) {
+        fprintf(stderr, "sw: CQ overrun\n");
+        rc = -1;
+    } else {
+        sw_cqe_t *e = &q->cq[q->cq_tail % SW_CQ_DEPTH];
+        memset(e, 0, sizeof(*e));
+        e->wc.wr_id = wr_id;
+        e->wc.opcode = op;
+        e->wc.status = status;
+        e->wc.byte_len = byte_len;
+        e->wc.imm_data = imm;
+        e->wc.wc_flags = with_imm ? IBV_WC_WITH_IMM : 0;
+        e->ready_ns = ready_ns;
+        q->cq_tail++;
+    }
+    pthread_mutex_unlock(&q->cq_lock);
+    return rc;
+}
+
+// 发送一条完整消息（可附带一个 fd）
+int sw_send_msg(sw_qp_t *q, const sw_msg_t *hdr, const void *payload, size_t len, int fd) {
+    struct iovec iov[2];
+    iov[0].iov_base = (void *)hdr;
+    iov[0].iov_len = sizeof(*hdr);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+        memset(cbuf, 0, sizeof(cbuf));
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+
+    size_t total = sizeof(*hdr) + len;
+    size_t done = 0;
+    while (done < total) {
+        ssize_t n = sendmsg(q->sock, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+        // 短写：跳过已发送部分继续（fd 只随第一段发送）
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+        size_t skip = (size_t)n;
+        while (msg.msg_iovlen > 0 && skip >= msg.msg_iov[0].iov_len) {
+            skip -= msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov[0].iov_base = (uint8_t *)msg.msg_iov[0].iov_base + skip;
+            msg.msg_iov[0].iov_len -= skip;
+        }
+    }
+    return 0;
+}
+
+int sw_read_full(int fd, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (uint8_t *)buf + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// 把到达的 SEND / WRITE_IMM 交给 Recv 队列头部的 Recv
+static int deliver(sw_qp_t *q, const sw_msg_t *hdr, const uint8_t *payload) {
+    sw_recv_t *r = &q->rq[q->rq_head % SW_RQ_DEPTH];
+    q->rq_head++;
+    if (hdr->type == SW_MSG_WRITE_IMM) {
+        return sw_cq_push(q, r->wr_id, IBV_WC_RECV_RDMA_WITH_IMM, IBV_WC_SUCCESS,
+                          hdr->len, hdr->imm, 1, hdr->ready_ns);
+    }
+    if (hdr->len > r->len) {
+        // Recv 缓冲区太小：与 verbs 一样报本地长度错误
+        return sw_cq_push(q, r->wr_id, IBV_WC_RECV, IBV_WC_LOC_LEN_ERR, 0, 0, 0, hdr->ready_ns);
+    }
+    memcpy(r->addr, payload, hdr->len);
+    return sw_cq_push(q, r->wr_id, IBV_WC_RECV, IBV_WC_SUCCESS, hdr->len, 0, 0, hdr->ready_ns);
+}
+
+static int fence_reached(sw_qp_t *q, const sw_msg_t *hdr) {
+    for (int i = 0; i < SW_FENCE_LANES; i++) {
+        if (__atomic_load_n(&q->placed_bytes[i], __ATOMIC_ACQUIRE) < hdr->fence[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 依次交付积压的消息：需要有 Recv 可用，且 fence 之前的数据已落位
+static int drain_pending(sw_qp_t *q) {
+    while (q->pend_head != q->pend_tail && q->rq_head != q->rq_tail) {
+        sw_pending_t *p = &q->pend[q->pend_head % SW_RQ_DEPTH];
+        if (!fence_reached(q, &p->hdr)) {
+            break;                                          // 数据还在路上
+        }
+        int rc = deliver(q, &p->hdr, p->payload);
+        free(p->payload);
+        p->payload = NULL;
+        q->pend_head++;
+        if (rc != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 读取并处理一条消息
+static int recv_one(sw_qp_t *q) {
+    sw_msg_t hdr;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &hdr, sizeof(hdr) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(q->sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n == 0) {
+        q->peer_closed = 1;                                 // 对端已关闭
+        return 0;
+    }
+    if (n < 0) {
+        return -1;
+    }
+    int fd = -1;
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (c && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(c), sizeof(int));
+    }
+    if ((size_t)n < sizeof(hdr) &&
+        sw_read_full(q->sock, (uint8_t *)&hdr + n, sizeof(hdr) - (size_t)n) != 0) {
+        return -1;
+    }
+
+    if (hdr.type != SW_MSG_SEND && hdr.type != SW_MSG_WRITE_IMM) {
+        if (q->on_msg) {
+            return q->on_msg(q, &hdr, fd);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    uint8_t *payload = NULL;
+    uint32_t plen = hdr.type == SW_MSG_SEND ? hdr.len : 0;
+    if (plen > SW_MAX_SEND) {
+        return -1;
+    }
+    if (plen > 0) {
+        payload = (uint8_t *)malloc(plen);
+        if (!payload || sw_read_full(q->sock, payload, plen) != 0) {
+            free(payload);
+            return -1;
+        }
+    }
+    if (q->pend_tail - q->pend_head == SW_RQ_DEPTH) {
+        free(payload);
+        return -1;
+    }
+    sw_pending_t *p = &q->pend[q->pend_tail % SW_RQ_DEPTH];
+    p->hdr = hdr;
+    p->payload = payload;
+    q->pend_tail++;
+    return drain_pending(q);                                // 条件满足则立即交付
+}
+
+// 处理所有已到达的消息（非阻塞）
+int sw_progress(sw_qp_t *q) {
+    while (q->connected && !q->peer_closed) {
+        struct pollfd pfd = { q->sock, POLLIN, 0 };
+        int n = poll(&pfd, 1, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (recv_one(q) != 0) {
+            return -1;
+        }
+    }
+    return drain_pending(q);                                // 数据落位后交付被 fence 挡住的消息
+}
+
+int sw_post_recv(sw_qp_t *q, struct ibv_sge *sge, uint64_t wr_id) {
+    uint64_t total = 0;
+    if (q->rq_tail - q->rq_head == SW_RQ_DEPTH || sw_check_sges(q, sge, 1, &total) != 0) {
+        return -1;
+    }
+    sw_recv_t *r = &q->rq[q->rq_tail % SW_RQ_DEPTH];
+    r->wr_id = wr_id;
+    r->addr = (uint8_t *)(uintptr_t)sge->addr;
+    r->len = sge->length;
+    q->rq_tail++;
+    return drain_pending(q);
+}
+
+int sw_post_send(sw_qp_t *q, struct ibv_sge *sge, int num_sge, uint64_t wr_id,
+                 uint64_t ready_ns, const uint64_t *fence) {
+    uint64_t total = 0;
+    if (!q->connected || q->peer_closed || sw_check_sges(q, sge, num_sge, &total) != 0 ||
+        total > SW_MAX_SEND) {
+        return -1;
+    }
+    uint8_t buf[SW_MAX_SEND];                               // 聚合 SGE 负载
+    uint64_t off = 0;
+    for (int i = 0; i < num_sge; i++) {
+        memcpy(buf + off, (void *)(uintptr_t)sge[i].addr, sge[i].length);
+        off += sge[i].length;
+    }
+    sw_msg_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = SW_MSG_SEND;
+    hdr.len = (uint32_t)total;
+    hdr.ready_ns = ready_ns;
+    if (fence) {
+        memcpy(hdr.fence, fence, sizeof(hdr.fence));
+    }
+    if (sw_send_msg(q, &hdr, buf, (size_t)total, -1) != 0) {
+        return -1;
+    }
+    return sw_cq_push(q, wr_id, IBV_WC_SEND, IBV_WC_SUCCESS, (uint32_t)total, 0, 0, ready_ns);
+}
+
+// Write with Imm 的通知部分（数据由后端自行写入）
+int sw_send_imm(sw_qp_t *q, uint32_t len, uint32_t imm, uint64_t ready_ns, const uint64_t *fence) {
+    sw_msg_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = SW_MSG_WRITE_IMM;
+    hdr.len = len;
+    hdr.imm = imm;
+    hdr.ready_ns = ready_ns;
+    if (fence) {
+        memcpy(hdr.fence, fence, sizeof(hdr.fence));
+    }
+    return sw_send_msg(q, &hdr, NULL, 0, -1);
+}
+
+int sw_poll(sw_qp_t *q, struct ibv_wc *wc, int max) {
+    if (sw_progress(q) < 0 || __atomic_load_n(&q->error, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    uint64_t now = now_ns();
+    int n = 0;
+    pthread_mutex_lock(&q->cq_lock);
+    while (n < max && q->cq_head != q->cq_tail) {
+        sw_cqe_t *e = &q->cq[q->cq_head % SW_CQ_DEPTH];
+        if (e->ready_ns > now) {
+            break;                                          // 按模型尚未完成
+        }
+        wc[n++] = e->wc;
+        q->cq_head++;
+    }
+    int empty = (q->cq_head == q->cq_tail);
+    pthread_mutex_unlock(&q->cq_lock);
+    if (n == 0 && q->peer_closed && empty && q->pend_head == q->pend_tail) {
+        return -1;                                          // 对端已断开且无事件可交付
+    }
+    return n;
+}
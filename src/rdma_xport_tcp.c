@@ -0,0 +1,873 @@
+﻿#define _GNU_SOURCE
+#include "rdma_xport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+// TCP 后端：没有 RDMA 设备（无 RNIC、也没有 rdma_rxe）的主机上的回退方案
+// 协议层（HELLO/MR/FIN/ACK）完全不变，只是把 verbs 语义搬到 TCP 上
+//
+// 连接结构：
+// - 控制连接 1 条：Send/Recv、Write with Imm 通知（软件 QP，rdma_xport_sw.c）
+// - 数据连接 N 条（RDMA_SIM_TCP_STREAMS，默认 RDMA_TCP_STREAMS）：承载 RDMA Write
+//   帧格式为 tcp_frame_t + 负载；较大的 WR 按段拆到多条流上并行发送
+//
+// 零拷贝：
+// - 发送端：源 MR 来自 rdma_mem_reg_file 时直接 sendfile(文件 -> socket)
+// - 接收端：目的 MR 来自 rdma_mem_alloc_file 时 splice(socket -> pipe -> 文件)
+// - 其余情况退化为普通 send / read
+//
+// 顺序：数据流与控制连接相互独立，控制消息携带 fence（发送前每条数据流已投递的字节数），
+// 对端每条流的落位都追上 fence 后才交付，保证 FIN / 立即数不会越过数据
+//
+// 限制：不支持 RDMA Read（本项目的协议只用 Write）
+
+#define TCP_MAGIC_CTRL 0x52544331u        // "RTC1"：控制连接握手
+#define TCP_MAGIC_DATA 0x52544431u        // "RTD1"：数据连接握手
+#define TCP_TX_DEPTH 256                  // 每条流的发送队列深度
+#define TCP_STRIPE_MIN (16 * 1024)        // 拆分到多条流的最小分段
+#define TCP_PIPE_SIZE (1 << 20)           // splice 中转管道容量（尽力设置）
+
+// 连接握手（客户端 -> 服务端；服务端在控制连接上原样回一份表示接受）
+typedef struct {
+    uint32_t magic;
+    uint32_t streams;                     // 数据流数量
+    uint64_t token;                       // 关联同一端点的控制/数据连接
+    uint32_t index;                       // 数据流序号
+    uint32_t reserved;
+} tcp_hello_t;
+
+// 数据帧头
+typedef struct {
+    uint32_t rkey;
+    uint32_t len;
+    uint64_t remote_addr;
+} tcp_frame_t;
+
+// 一个 RDMA Write（可能被拆成多段）
+typedef struct {
+    uint64_t wr_id;
+    uint32_t total;
+    int remaining;                        // 未完成的分段数（原子）
+    int failed;
+} tcp_wr_t;
+
+// 发送队列中的一段
+typedef struct {
+    tcp_wr_t *wr;
+    struct ibv_sge sge[RDMA_MAX_SGE];
+    int num_sge;
+    uint32_t len;
+    uint32_t rkey;
+    uint64_t remote_addr;
+} tcp_job_t;
+
+typedef struct tcp_ep tcp_ep_t;
+
+typedef struct {
+    tcp_ep_t *owner;
+    int fd;
+    pthread_t tx, rx;
+    int tx_started, rx_started;
+
+    pthread_mutex_t lock;                 // 保护发送队列
+    pthread_cond_t cond;
+    tcp_job_t *jobs;
+    unsigned head, tail;
+    int stop;
+
+    int pipe_fd[2];                       // 接收端 splice 中转
+    int no_splice;                        // 目的文件系统不支持 splice，改用 read
+} tcp_stream_t;
+
+struct tcp_ep {
+    sw_qp_t qp;                           // 软件 QP（控制连接）
+    struct addrinfo *ai;                  // 发送端：对端地址
+    uint64_t token;
+    int nstreams;
+    tcp_stream_t streams[RDMA_TCP_MAX_STREAMS];
+    unsigned next_stream;                 // 轮转选择数据流
+    int plugged;                          // 批量投递中：入队先不唤醒发送线程，结束时统一唤醒
+    uint64_t posted_bytes[SW_FENCE_LANES];    // 每条数据流已投递的 Write 字节数（作为 fence）
+    int stopping;
+};
+
+typedef struct {
+    int fd;
+} tcp_listener_t;
+
+static tcp_ep_t *tep(rdma_ep_t *ep) {
+    return (tcp_ep_t *)ep->priv;
+}
+
+static int stream_count(void) {
+    const char *v = getenv("RDMA_SIM_TCP_STREAMS");
+    int n = v ? atoi(v) : RDMA_TCP_STREAMS;
+    if (n < 1) {
+        n = 1;
+    }
+    if (n > RDMA_TCP_MAX_STREAMS) {
+        n = RDMA_TCP_MAX_STREAMS;
+    }
+    return n;
+}
+
+static int write_full(int fd, const void *buf, size_t len, int flags) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = send(fd, (const uint8_t *)buf + done, len - done, MSG_NOSIGNAL | flags);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// 丢弃 len 字节（无效帧的负载）
+static int discard(int fd, size_t len) {
+    uint8_t buf[4096];
+    while (len > 0) {
+        size_t n = len < sizeof(buf) ? len : sizeof(buf);
+        if (sw_read_full(fd, buf, n) != 0) {
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+// 一段 Write 完成；最后一段负责生成完成事件
+static void wr_done(tcp_ep_t *t, tcp_wr_t *wr, int ok) {
+    if (!ok) {
+        __atomic_store_n(&wr->failed, 1, __ATOMIC_RELEASE);
+    }
+    if (__atomic_sub_fetch(&wr->remaining, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    int failed = __atomic_load_n(&wr->failed, __ATOMIC_ACQUIRE);
+    sw_cq_push(&t->qp, wr->wr_id, IBV_WC_RDMA_WRITE, failed ? IBV_WC_WR_FLUSH_ERR : IBV_WC_SUCCESS,
+               failed ? 0 : wr->total, 0, 0, 0);
+    free(wr);
+}
+
+// 发送一个本地 SGE：文件源走 sendfile，其余走 send
+static int send_sge(tcp_ep_t *t, int sock, const struct ibv_sge *sge, int more) {
+    sw_mr_t mr;
+    if (sw_mr_lookup(&t->qp, sge->lkey, &mr) != 0) {
+        return -1;
+    }
+    uint64_t off = sge->addr - (uint64_t)(uintptr_t)mr.addr;
+    size_t left = sge->length;
+    if (mr.fd >= 0 && !mr.file_dst) {
+        off_t foff = (off_t)off;
+        while (left > 0) {
+            ssize_t n = sendfile(sock, mr.fd, &foff, left);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS) && left == sge->length) {
+                break;                                      // 文件不支持 sendfile：走映射
+            }
+            if (n <= 0) {
+                return -1;
+            }
+            left -= (size_t)n;
+        }
+        if (left == 0) {
+            return 0;
+        }
+    }
+    return write_full(sock, (const void *)(uintptr_t)sge->addr, left, more ? MSG_MORE : 0);
+}
+
+static void *tx_thread(void *arg) {
+    tcp_stream_t *st = (tcp_stream_t *)arg;
+    tcp_ep_t *t = st->owner;
+    while (1) {
+        pthread_mutex_lock(&st->lock);
+        while (st->head == st->tail && !st->stop) {
+            pthread_cond_wait(&st->cond, &st->lock);
+        }
+        if (st->head == st->tail) {
+            pthread_mutex_unlock(&st->lock);
+            break;                                          // stop 且队列已空
+        }
+        tcp_job_t *job = &st->jobs[st->head % TCP_TX_DEPTH];
+        pthread_mutex_unlock(&st->lock);
+
+        tcp_frame_t f;
+        f.rkey = job->rkey;
+        f.len = job->len;
+        f.remote_addr = job->remote_addr;
+        int ok = write_full(st->fd, &f, sizeof(f), MSG_MORE) == 0;
+        for (int i = 0; ok && i < job->num_sge; i++) {
+            ok = send_sge(t, st->fd, &job->sge[i], i + 1 < job->num_sge) == 0;
+        }
+        if (!ok && !__atomic_load_n(&t->stopping, __ATOMIC_ACQUIRE)) {
+            fprintf(stderr, "tcp: data stream send failed\n");
+            __atomic_store_n(&t->qp.error, 1, __ATOMIC_RELEASE);
+        }
+        wr_done(t, job->wr, ok);
+
+        pthread_mutex_lock(&st->lock);
+        st->head++;
+        pthread_cond_broadcast(&st->cond);                  // 唤醒等待队列空位的投递方
+        pthread_mutex_unlock(&st->lock);
+    }
+    return NULL;
+}
+
+// 负载 splice 进目的文件：socket -> pipe -> 文件
+static int splice_to_file(tcp_stream_t *st, const sw_mr_t *mr, uint64_t off, size_t len) {
+    loff_t foff = (loff_t)off;
+    while (len > 0) {
+        size_t want = len < TCP_PIPE_SIZE ? len : TCP_PIPE_SIZE;
+        ssize_t n = splice(st->fd, NULL, st->pipe_fd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        size_t in_pipe = (size_t)n;
+        while (in_pipe > 0) {
+            ssize_t m = splice(st->pipe_fd[0], NULL, mr->fd, &foff, in_pipe, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR) {
+                continue;
+            }
+            if (m < 0 && errno == EINVAL) {
+                // 文件系统不支持 splice 写入：把管道里的数据读到映射上，之后改走 read
+                st->no_splice = 1;
+                if (sw_read_full(st->pipe_fd[0], mr->addr + foff, in_pipe) != 0) {
+                    return -1;
+                }
+                foff += (loff_t)in_pipe;
+                len -= in_pipe;
+                return len ? sw_read_full(st->fd, mr->addr + foff, len) : 0;
+            }
+            if (m <= 0) {
+                return -1;
+            }
+            in_pipe -= (size_t)m;
+        }
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void *rx_thread(void *arg) {
+    tcp_stream_t *st = (tcp_stream_t *)arg;
+    tcp_ep_t *t = st->owner;
+    while (1) {
+        tcp_frame_t f;
+        ssize_t n;
+        do {
+            n = recv(st->fd, &f, sizeof(f), MSG_WAITALL);
+        } while (n < 0 && errno == EINTR);
+        if (n == 0) {
+            break;                                          // 对端正常关闭
+        }
+        if (n != (ssize_t)sizeof(f)) {
+            goto fail;
+        }
+        sw_mr_t mr;
+        if (sw_mr_lookup(&t->qp, f.rkey, &mr) != 0 || !(mr.access & IBV_ACCESS_REMOTE_WRITE) ||
+            f.remote_addr < (uint64_t)(uintptr_t)mr.addr ||
+            f.remote_addr + f.len > (uint64_t)(uintptr_t)mr.addr + mr.len) {
+            // rkey 无效 / 越界 / 权限不足：丢弃负载，QP 进入错误状态
+            fprintf(stderr, "tcp: remote access error (rkey=%u len=%u)\n", f.rkey, f.len);
+            discard(st->fd, f.len);
+            goto fail;
+        }
+        uint64_t off = f.remote_addr - (uint64_t)(uintptr_t)mr.addr;
+        int rc;
+        if (mr.file_dst && !st->no_splice) {
+            rc = splice_to_file(st, &mr, off, f.len);
+        } else {
+            rc = sw_read_full(st->fd, mr.addr + off, f.len);
+        }
+        if (rc != 0) {
+            goto fail;
+        }
+        __atomic_add_fetch(&t->qp.placed_bytes[st - t->streams], f.len, __ATOMIC_RELEASE);
+    }
+    return NULL;
+
+fail:
+    if (!__atomic_load_n(&t->stopping, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&t->qp.error, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static int stream_init(tcp_ep_t *t, tcp_stream_t *st) {
+    st->owner = t;
+    st->fd = -1;
+    st->pipe_fd[0] = st->pipe_fd[1] = -1;
+    st->jobs = (tcp_job_t *)calloc(TCP_TX_DEPTH, sizeof(tcp_job_t));
+    if (!st->jobs) {
+        return -1;
+    }
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->cond, NULL);
+    return 0;
+}
+
+static int stream_start(tcp_stream_t *st) {
+    if (pipe2(st->pipe_fd, O_CLOEXEC) != 0) {
+        perror("tcp: pipe");
+        return -1;
+    }
+    fcntl(st->pipe_fd[1], F_SETPIPE_SZ, TCP_PIPE_SIZE);   // 失败则用默认容量
+    if (pthread_create(&st->tx, NULL, tx_thread, st) != 0) {
+        return -1;
+    }
+    st->tx_started = 1;
+    if (pthread_create(&st->rx, NULL, rx_thread, st) != 0) {
+        return -1;
+    }
+    st->rx_started = 1;
+    return 0;
+}
+
+static void stream_stop(tcp_stream_t *st) {
+    pthread_mutex_lock(&st->lock);
+    st->stop = 1;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->lock);
+    if (st->fd >= 0) {
+        shutdown(st->fd, SHUT_RDWR);                        // 唤醒阻塞在 socket 上的线程
+    }
+    if (st->tx_started) {
+        pthread_join(st->tx, NULL);
+    }
+    if (st->rx_started) {
+        pthread_join(st->rx, NULL);
+    }
+    // 未发出的分段
+    while (st->head != st->tail) {
+        wr_done(st->owner, st->jobs[st->head % TCP_TX_DEPTH].wr, 0);
+        st->head++;
+    }
+    if (st->fd >= 0) {
+        close(st->fd);
+    }
+    if (st->pipe_fd[0] >= 0) {
+        close(st->pipe_fd[0]);
+        close(st->pipe_fd[1]);
+    }
+    free(st->jobs);
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->lock);
+}
+
+static tcp_ep_t *new_ep(rdma_ep_t *ep) {
+    tcp_ep_t *t = (tcp_ep_t *)calloc(1, sizeof(*t));
+    if (!t) {
+        return NULL;
+    }
+    if (sw_qp_init(&t->qp) != 0) {
+        free(t);
+        return NULL;
+    }
+    for (int i = 0; i < RDMA_TCP_MAX_STREAMS; i++) {
+        if (stream_init(t, &t->streams[i]) != 0) {
+            for (int j = 0; j < i; j++) {
+                stream_stop(&t->streams[j]);
+            }
+            sw_qp_destroy(&t->qp);
+            free(t);
+            return NULL;
+        }
+    }
+    ep->priv = t;
+    ep->max_sge = RDMA_MAX_SGE;
+    return t;
+}
+
+static void free_ep(rdma_ep_t *ep) {
+    tcp_ep_t *t = tep(ep);
+    __atomic_store_n(&t->stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < RDMA_TCP_MAX_STREAMS; i++) {
+        stream_stop(&t->streams[i]);
+    }
+    if (t->ai) {
+        freeaddrinfo(t->ai);
+    }
+    sw_qp_destroy(&t->qp);
+    free(t);
+    ep->priv = NULL;
+}
+
+static int start_streams(tcp_ep_t *t) {
+    for (int i = 0; i < t->nstreams; i++) {
+        if (stream_start(&t->streams[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int connect_one(const struct addrinfo *ai) {
+    int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int tcp_create(rdma_ep_t *ep, const char *ip, const char *port) {
+    tcp_ep_t *t = new_ep(ep);
+    if (!t) {
+        return -1;
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(ip, port, &hints, &t->ai);
+    if (rc != 0) {
+        fprintf(stderr, "tcp: getaddrinfo: %s\n", gai_strerror(rc));
+        t->ai = NULL;
+        free_ep(ep);
+        return -1;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    t->token = ((uint64_t)getpid() << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 20);
+    t->nstreams = stream_count();
+    return 0;
+}
+
+static int tcp_connect(rdma_ep_t *ep) {
+    tcp_ep_t *t = tep(ep);
+    t->qp.sock = connect_one(t->ai);
+    if (t->qp.sock < 0) {
+        perror("tcp: connect");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(t->qp.sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // 控制消息都很小
+
+    tcp_hello_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = TCP_MAGIC_CTRL;
+    h.streams = (uint32_t)t->nstreams;
+    h.token = t->token;
+    if (write_full(t->qp.sock, &h, sizeof(h), 0) != 0) {
+        return -1;
+    }
+    h.magic = TCP_MAGIC_DATA;
+    for (int i = 0; i < t->nstreams; i++) {
+        tcp_stream_t *st = &t->streams[i];
+        st->fd = connect_one(t->ai);
+        h.index = (uint32_t)i;
+        if (st->fd < 0 || write_full(st->fd, &h, sizeof(h), 0) != 0) {
+            perror("tcp: connect data stream");
+            return -1;
+        }
+    }
+
+    // 等待服务端确认（所有数据流都已配对）
+    tcp_hello_t ack;
+    if (sw_read_full(t->qp.sock, &ack, sizeof(ack)) != 0 || ack.magic != TCP_MAGIC_CTRL ||
+        ack.token != t->token) {
+        fprintf(stderr, "tcp: handshake rejected\n");
+        return -1;
+    }
+    if (start_streams(t) != 0) {
+        return -1;
+    }
+    t->qp.connected = 1;
+    return 0;
+}
+
+static int tcp_listen(rdma_listener_t *ln, const char *ip, const char *port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *res = NULL;
+    int rc = getaddrinfo(ip, port, &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "tcp: getaddrinfo: %s\n", gai_strerror(rc));
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+    if (fd < 0) {
+        perror("tcp: socket");
+        freeaddrinfo(res);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, res->ai_addr, res->ai_addrlen) != 0 || listen(fd, RDMA_TCP_MAX_STREAMS * 2) != 0) {
+        int err = errno;                                    // 保留给调用方（AUTO 要区分地址被占用）
+        perror("tcp: bind/listen");
+        close(fd);
+        freeaddrinfo(res);
+        errno = err;
+        return -1;
+    }
+    freeaddrinfo(res);
+    tcp_listener_t *l = (tcp_listener_t *)calloc(1, sizeof(*l));
+    if (!l) {
+        close(fd);
+        return -1;
+    }
+    l->fd = fd;
+    ln->priv = l;
+    return 0;
+}
+
+static int accept_hello(int lfd, tcp_hello_t *h) {
+    while (1) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        }
+        if (fd < 0) {
+            return -1;
+        }
+        if (sw_read_full(fd, h, sizeof(*h)) == 0) {
+            return fd;
+        }
+        close(fd);                                          // 握手不完整，继续等
+    }
+}
+
+static int tcp_get_request(rdma_listener_t *ln, rdma_ep_t *ep) {
+    tcp_listener_t *l = (tcp_listener_t *)ln->priv;
+    tcp_ep_t *t = new_ep(ep);
+    if (!t) {
+        return -1;
+    }
+    // 先等控制连接，再收齐同一 token 的数据连接（不匹配的连接直接关闭）
+    tcp_hello_t h;
+    while (1) {
+        int fd = accept_hello(l->fd, &h);
+        if (fd < 0) {
+            perror("tcp: accept");
+            free_ep(ep);
+            return -1;
+        }
+        if (h.magic == TCP_MAGIC_CTRL && h.streams >= 1 && h.streams <= RDMA_TCP_MAX_STREAMS) {
+            t->qp.sock = fd;
+            break;
+        }
+        close(fd);
+    }
+    int one = 1;
+    setsockopt(t->qp.sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    t->token = h.token;
+    t->nstreams = (int)h.streams;
+
+    int have = 0;
+    while (have < t->nstreams) {
+        int fd = accept_hello(l->fd, &h);
+        if (fd < 0) {
+            perror("tcp: accept data stream");
+            free_ep(ep);
+            return -1;
+        }
+        if (h.magic != TCP_MAGIC_DATA || h.token != t->token || h.index >= (uint32_t)t->nstreams ||
+            t->streams[h.index].fd >= 0) {
+            close(fd);
+            continue;
+        }
+        t->streams[h.index].fd = fd;
+        have++;
+    }
+    return 0;
+}
+
+static int tcp_accept(rdma_ep_t *ep) {
+    tcp_ep_t *t = tep(ep);
+    if (start_streams(t) != 0) {
+        return -1;
+    }
+    tcp_hello_t ack;
+    memset(&ack, 0, sizeof(ack));
+    ack.magic = TCP_MAGIC_CTRL;
+    ack.streams = (uint32_t)t->nstreams;
+    ack.token = t->token;
+    if (write_full(t->qp.sock, &ack, sizeof(ack), 0) != 0) {
+        perror("tcp: send handshake ack");
+        return -1;
+    }
+    t->qp.connected = 1;
+    return 0;
+}
+
+static void tcp_close_listener(rdma_listener_t *ln) {
+    tcp_listener_t *l = (tcp_listener_t *)ln->priv;
+    if (!l) {
+        return;
+    }
+    close(l->fd);
+    free(l);
+    ln->priv = NULL;
+}
+
+static int tcp_listen_fd(rdma_listener_t *ln) {
+    return ((tcp_listener_t *)ln->priv)->fd;
+}
+
+// 普通内存：TCP 下任何内存都可被远端写入，无需特殊分配
+static int tcp_mem_reg(rdma_ep_t *ep, void *buf, size_t len, int access, rdma_mem_t *mem) {
+    sw_mr_t *mr = sw_mr_add(&tep(ep)->qp, (uint8_t *)buf, len, access, -1);
+    if (!mr) {
+        return -1;
+    }
+    sw_fill_mem(mem, mr);
+    return 0;
+}
+
+static int tcp_mem_alloc(rdma_ep_t *ep, size_t len, int access, rdma_mem_t *mem) {
+    void *buf = NULL;
+    if (posix_memalign(&buf, 4096, len) != 0) {
+        return -1;
+    }
+    if (tcp_mem_reg(ep, buf, len, access, mem) != 0) {
+        free(buf);
+        return -1;
+    }
+    mem->owned = 1;
+    return 0;
+}
+
+// 源文件：记下 fd，发送时 sendfile（映射由 rdma_xport.c 建立和释放）
+static int tcp_mem_reg_file(rdma_ep_t *ep, int fd, void *map, size_t len, int access,
+                            rdma_mem_t *mem) {
+    sw_mr_t *mr = sw_mr_add(&tep(ep)->qp, (uint8_t *)map, len, access, fd);
+    if (!mr) {
+        return -1;
+    }
+    sw_fill_mem(mem, mr);
+    return 0;
+}
+
+// 目的文件：数据 splice 进 fd；同时映射一份，便于本端直接读取内容
+static int tcp_mem_alloc_file(rdma_ep_t *ep, int fd, size_t len, int access, rdma_mem_t *mem) {
+    uint8_t *map = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("tcp: mmap destination file");
+        return -1;
+    }
+    tcp_ep_t *t = tep(ep);
+    sw_mr_t *mr = sw_mr_add(&t->qp, map, len, access, fd);
+    if (!mr) {
+        munmap(map, len);
+        return -1;
+    }
+    mr->file_dst = 1;                                       // 调用线程独占修改 MR 表，可直接写
+    sw_fill_mem(mem, mr);
+    return 0;
+}
+
+static void tcp_mem_dereg(rdma_ep_t *ep, rdma_mem_t *mem) {
+    tcp_ep_t *t = tep(ep);
+    uint32_t key = (uint32_t)(uintptr_t)mem->priv;
+    sw_mr_t mr;
+    if (sw_mr_lookup(&t->qp, key, &mr) != 0) {
+        return;
+    }
+    sw_mr_del(&t->qp, key);
+    if (mr.file_dst) {
+        munmap(mr.addr, mr.len);
+    } else if (mem->owned) {
+        free(mr.addr);
+    }
+}
+
+static int tcp_post_recv(rdma_ep_t *ep, struct ibv_sge *sge, uint64_t wr_id) {
+    return sw_post_recv(&tep(ep)->qp, sge, wr_id);
+}
+
+static int tcp_post_send(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge, uint64_t wr_id) {
+    tcp_ep_t *t = tep(ep);
+    return sw_post_send(&t->qp, sge, num_sge, wr_id, 0, t->posted_bytes);
+}
+
+// 取 SGE 列表中 [off, off+len) 这一段
+static int slice_sges(const struct ibv_sge *sge, int num_sge, uint64_t off, uint64_t len,
+                      struct ibv_sge *out) {
+    int n = 0;
+    for (int i = 0; i < num_sge && len > 0; i++) {
+        if (off >= sge[i].length) {
+            off -= sge[i].length;
+            continue;
+        }
+        uint64_t take = sge[i].length - off;
+        if (take > len) {
+            take = len;
+        }
+        out[n] = sge[i];
+        out[n].addr += off;
+        out[n].length = (uint32_t)take;
+        n++;
+        len -= take;
+        off = 0;
+    }
+    return n;
+}
+
+static int enqueue(tcp_stream_t *st, const tcp_job_t *job, int wake) {
+    pthread_mutex_lock(&st->lock);
+    while (st->tail - st->head == TCP_TX_DEPTH && !st->stop) {
+        pthread_cond_broadcast(&st->cond);                  // 批量投递时发送线程可能还没被唤醒
+        pthread_cond_wait(&st->cond, &st->lock);            // 队列满：等发送线程腾出空位
+    }
+    if (st->stop) {
+        pthread_mutex_unlock(&st->lock);
+        return -1;
+    }
+    st->jobs[st->tail % TCP_TX_DEPTH] = *job;
+    st->tail++;
+    if (wake) {
+        pthread_cond_broadcast(&st->cond);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return 0;
+}
+
+static void wake_stream(tcp_stream_t *st) {
+    pthread_mutex_lock(&st->lock);
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->lock);
+}
+
+static int tcp_post_rdma(rdma_ep_t *ep, enum ibv_wr_opcode op, struct ibv_sge *sge, int num_sge,
+                         uint64_t remote_addr, uint32_t rkey, uint32_t imm, uint64_t wr_id) {
+    tcp_ep_t *t = tep(ep);
+    if (!t->qp.connected || t->qp.peer_closed) {
+        return -1;
+    }
+    if (op == IBV_WR_RDMA_READ) {
+        fprintf(stderr, "tcp: RDMA Read is not supported\n");
+        return -1;
+    }
+    uint64_t total = 0;
+    if (sw_check_sges(&t->qp, sge, num_sge, &total) != 0) {
+        return sw_cq_push(&t->qp, wr_id, IBV_WC_RDMA_WRITE, IBV_WC_LOC_PROT_ERR, 0, 0, 0, 0);
+    }
+
+    // 分段：每段至少 TCP_STRIPE_MIN，最多拆到每条流一段
+    int pieces = (int)(total / TCP_STRIPE_MIN);
+    if (pieces > t->nstreams) {
+        pieces = t->nstreams;
+    }
+    if (pieces < 1) {
+        pieces = 1;
+    }
+    tcp_wr_t *wr = (tcp_wr_t *)calloc(1, sizeof(*wr));
+    if (!wr) {
+        return -1;
+    }
+    wr->wr_id = wr_id;
+    wr->total = (uint32_t)total;
+    wr->remaining = pieces;
+
+    uint64_t per = (total + (uint64_t)pieces - 1) / (uint64_t)pieces;
+    uint64_t off = 0;
+    for (int i = 0; i < pieces; i++) {
+        uint64_t len = total - off < per ? total - off : per;
+        tcp_job_t job;
+        job.wr = wr;
+        job.num_sge = slice_sges(sge, num_sge, off, len, job.sge);
+        job.len = (uint32_t)len;
+        job.rkey = rkey;
+        job.remote_addr = remote_addr + off;
+        unsigned s = t->next_stream++ % (unsigned)t->nstreams;
+        if (enqueue(&t->streams[s], &job, !t->plugged) != 0) {
+            // 剩余分段不再发送，由已入队的分段（或这里）收尾
+            for (int j = i; j < pieces; j++) {
+                wr_done(t, wr, 0);
+            }
+            return -1;
+        }
+        t->posted_bytes[s] += len;
+        off += len;
+    }
+
+    if (op == IBV_WR_RDMA_WRITE_WITH_IMM) {
+        return sw_send_imm(&t->qp, (uint32_t)total, imm, 0, t->posted_bytes);
+    }
+    return 0;
+}
+
+// 批量投递：整批入队后每条数据流只唤醒一次（相当于 verbs 的门铃合并）
+static int tcp_post_batch(rdma_ep_t *ep, rdma_wr_batch_t *b) {
+    tcp_ep_t *t = tep(ep);
+    int n = b->n;
+    b->n = 0;
+    int posted = 0;
+    t->plugged = 1;
+    for (; posted < n; posted++) {
+        struct ibv_send_wr *wr = &b->wr[posted];
+        if (tcp_post_rdma(ep, wr->opcode, wr->sg_list, wr->num_sge, wr->wr.rdma.remote_addr,
+                          wr->wr.rdma.rkey, ntohl(wr->imm_data), wr->wr_id) != 0) {
+            break;
+        }
+    }
+    t->plugged = 0;
+    for (int i = 0; i < t->nstreams; i++) {
+        wake_stream(&t->streams[i]);
+    }
+    return posted;
+}
+
+static int tcp_poll(rdma_ep_t *ep, struct ibv_wc *wc, int max) {
+    return sw_poll(&tep(ep)->qp, wc, max);
+}
+
+static void tcp_close(rdma_ep_t *ep) {
+    if (!tep(ep)) {
+        return;
+    }
+    free_ep(ep);
+}
+
+const rdma_xport_ops_t rdma_xport_tcp_ops = {
+    .name = "tcp",
+    .create = tcp_create,
+    .connect = tcp_connect,
+    .listen = tcp_listen,
+    .get_request = tcp_get_request,
+    .accept = tcp_accept,
+    .close_listener = tcp_close_listener,
+    .listen_fd = tcp_listen_fd,
+    .mem_reg = tcp_mem_reg,
+    .mem_alloc = tcp_mem_alloc,
+    .mem_dereg = tcp_mem_dereg,
+    .mem_reg_file = tcp_mem_reg_file,
+    .mem_alloc_file = tcp_mem_alloc_file,
+    .post_recv = tcp_post_recv,
+    .post_send = tcp_post_send,
+    .post_rdma = tcp_post_rdma,
+    .post_batch = tcp_post_batch,
+    .poll = tcp_poll,
+    .close = tcp_close,
+};
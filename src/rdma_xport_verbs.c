@@ -0,0 +1,373 @@
+﻿#include "rdma_xport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+// verbs 后端：真实 rdma-core（RNIC 或 Soft-RoCE）
+// 说明：建连流程与原先 sender/receiver 中的一致，只是搬进了后端
+// - 发送端：getaddrinfo -> event channel -> cm_id -> resolve addr/route -> build QP -> connect
+// - 接收端：getaddrinfo(PASSIVE) -> bind -> listen -> CONNECT_REQUEST -> build QP -> accept
+
+typedef struct {
+    struct rdma_event_channel *ec;        // 事件通道（发送端自有；接收端借用监听端的）
+    struct rdma_cm_id *id;                // 连接 CM ID（含 QP）
+    struct ibv_pd *pd;
+    struct ibv_cq *cq;
+    struct ibv_comp_channel *comp_chan;
+    int own_ec;                           // 是否由本端点负责销毁 ec
+} verbs_ep_t;
+
+typedef struct {
+    struct rdma_event_channel *ec;
+    struct rdma_cm_id *listen_id;
+} verbs_listener_t;
+
+static verbs_ep_t *vep(rdma_ep_t *ep) {
+    return (verbs_ep_t *)ep->priv;
+}
+
+// 建好 PD/CQ/QP 后记录实际 SGE 上限
+static int verbs_setup_qp(rdma_ep_t *ep) {
+    verbs_ep_t *v = vep(ep);
+    if (rdma_build_qp(v->id, &v->pd, &v->cq, &v->comp_chan) != 0) {
+        fprintf(stderr, "rdma_build_qp failed\n");
+        return -1;
+    }
+    if (rdma_query_max_sge(v->id, &ep->max_sge) != 0) {
+        fprintf(stderr, "query max_sge failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int verbs_create(rdma_ep_t *ep, const char *ip, const char *port) {
+    verbs_ep_t *v = (verbs_ep_t *)calloc(1, sizeof(*v));
+    if (!v) {
+        return -1;
+    }
+    ep->priv = v;
+    v->own_ec = 1;
+
+    // 1) 地址解析：把 ip+port 解析为 RDMA CM 地址
+    struct rdma_addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_port_space = RDMA_PS_TCP;                      // TCP 语义的 RDMA CM
+    struct rdma_addrinfo *res = NULL;
+    if (rdma_getaddrinfo((char *)ip, (char *)port, &hints, &res) != 0) {
+        perror("rdma_getaddrinfo");
+        goto fail;
+    }
+
+    // 2) 创建事件通道 + CM ID
+    v->ec = rdma_create_event_channel();
+    if (!v->ec) {
+        perror("rdma_create_event_channel");
+        goto fail_res;
+    }
+    if (rdma_create_id(v->ec, &v->id, NULL, RDMA_PS_TCP) != 0) {
+        perror("rdma_create_id");
+        goto fail_res;
+    }
+
+    // 3) 解析地址与路由（RDMA CM 必需步骤）
+    if (rdma_resolve_addr(v->id, NULL, res->ai_dst_addr, 2000) != 0) {
+        perror("rdma_resolve_addr");
+        goto fail_res;
+    }
+    if (rdma_wait_event(v->ec, RDMA_CM_EVENT_ADDR_RESOLVED, NULL) != 0) {
+        fprintf(stderr, "ADDR_RESOLVED failed\n");
+        goto fail_res;
+    }
+    if (rdma_resolve_route(v->id, 2000) != 0) {
+        perror("rdma_resolve_route");
+        goto fail_res;
+    }
+    if (rdma_wait_event(v->ec, RDMA_CM_EVENT_ROUTE_RESOLVED, NULL) != 0) {
+        fprintf(stderr, "ROUTE_RESOLVED failed\n");
+        goto fail_res;
+    }
+    rdma_freeaddrinfo(res);
+
+    // 4) 创建 QP/CQ/PD（通信与完成机制）
+    if (verbs_setup_qp(ep) != 0) {
+        goto fail;
+    }
+    return 0;
+
+fail_res:
+    rdma_freeaddrinfo(res);
+fail:
+    if (v->id) {
+        rdma_destroy_id(v->id);
+    }
+    if (v->ec) {
+        rdma_destroy_event_channel(v->ec);
+    }
+    free(v);
+    ep->priv = NULL;
+    return -1;
+}
+
+static int verbs_connect(rdma_ep_t *ep) {
+    verbs_ep_t *v = vep(ep);
+    struct rdma_conn_param conn_param;
+    memset(&conn_param, 0, sizeof(conn_param));
+    conn_param.initiator_depth = 1;
+    conn_param.responder_resources = 1;
+    conn_param.retry_count = 7;
+    conn_param.rnr_retry_count = 7;                         // 对端 Recv 未就绪时无限重试
+    if (rdma_connect(v->id, &conn_param) != 0) {
+        perror("rdma_connect");
+        return -1;
+    }
+    if (rdma_wait_event(v->ec, RDMA_CM_EVENT_ESTABLISHED, NULL) != 0) {
+        fprintf(stderr, "ESTABLISHED failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int verbs_listen(rdma_listener_t *ln, const char *ip, const char *port) {
+    verbs_listener_t *l = (verbs_listener_t *)calloc(1, sizeof(*l));
+    if (!l) {
+        return -1;
+    }
+
+    // 解析监听地址并创建监听 CM ID
+    // 说明：listen 端必须先 bind + listen，等待对端 connect
+    struct rdma_addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = RAI_PASSIVE;                           // 被动监听
+    hints.ai_port_space = RDMA_PS_TCP;
+    struct rdma_addrinfo *res = NULL;
+    if (rdma_getaddrinfo((char *)ip, (char *)port, &hints, &res) != 0) {
+        perror("rdma_getaddrinfo");
+        free(l);
+        return -1;
+    }
+
+    l->ec = rdma_create_event_channel();
+    if (!l->ec) {
+        perror("rdma_create_event_channel");
+        goto fail;
+    }
+    if (rdma_create_id(l->ec, &l->listen_id, NULL, RDMA_PS_TCP) != 0) {
+        perror("rdma_create_id");
+        goto fail;
+    }
+    if (rdma_bind_addr(l->listen_id, res->ai_src_addr) != 0) {
+        perror("rdma_bind_addr");
+        goto fail;
+    }
+    if (rdma_listen(l->listen_id, 1) != 0) {
+        perror("rdma_listen");
+        goto fail;
+    }
+    rdma_freeaddrinfo(res);
+    ln->priv = l;
+    return 0;
+
+fail:
+    rdma_freeaddrinfo(res);
+    if (l->listen_id) {
+        rdma_destroy_id(l->listen_id);
+    }
+    if (l->ec) {
+        rdma_destroy_event_channel(l->ec);
+    }
+    free(l);
+    return -1;
+}
+
+static int verbs_get_request(rdma_listener_t *ln, rdma_ep_t *ep) {
+    verbs_listener_t *l = (verbs_listener_t *)ln->priv;
+    verbs_ep_t *v = (verbs_ep_t *)calloc(1, sizeof(*v));
+    if (!v) {
+        return -1;
+    }
+    ep->priv = v;
+    v->ec = l->ec;                                          // 连接事件仍走监听端的通道
+
+    // 等待连接请求（CM 事件），再为新 cm_id 创建 QP/CQ/PD
+    if (rdma_wait_event(l->ec, RDMA_CM_EVENT_CONNECT_REQUEST, &v->id) != 0) {
+        fprintf(stderr, "CONNECT_REQUEST failed\n");
+        free(v);
+        ep->priv = NULL;
+        return -1;
+    }
+    if (verbs_setup_qp(ep) != 0) {
+        rdma_destroy_id(v->id);
+        free(v);
+        ep->priv = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int verbs_accept(rdma_ep_t *ep) {
+    verbs_ep_t *v = vep(ep);
+    struct rdma_conn_param conn_param;
+    memset(&conn_param, 0, sizeof(conn_param));
+    conn_param.initiator_depth = 1;
+    conn_param.responder_resources = 1;
+    conn_param.rnr_retry_count = 7;
+    if (rdma_accept(v->id, &conn_param) != 0) {
+        perror("rdma_accept");
+        return -1;
+    }
+    if (rdma_wait_event(v->ec, RDMA_CM_EVENT_ESTABLISHED, NULL) != 0) {
+        fprintf(stderr, "ESTABLISHED failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void verbs_close_listener(rdma_listener_t *ln) {
+    verbs_listener_t *l = (verbs_listener_t *)ln->priv;
+    if (!l) {
+        return;
+    }
+    rdma_destroy_id(l->listen_id);
+    rdma_destroy_event_channel(l->ec);
+    free(l);
+    ln->priv = NULL;
+}
+
+static int verbs_listen_fd(rdma_listener_t *ln) {
+    return ((verbs_listener_t *)ln->priv)->ec->fd;
+}
+
+static int verbs_mem_reg(rdma_ep_t *ep, void *buf, size_t len, int access, rdma_mem_t *mem) {
+    struct ibv_mr *mr = NULL;
+    if (rdma_register_mr(vep(ep)->pd, buf, len, access, &mr) != 0) {
+        return -1;
+    }
+    mem->addr = buf;
+    mem->length = len;
+    mem->lkey = mr->lkey;
+    mem->rkey = mr->rkey;
+    mem->priv = mr;
+    return 0;
+}
+
+static int verbs_mem_alloc(rdma_ep_t *ep, size_t len, int access, rdma_mem_t *mem) {
+    void *buf = NULL;
+    if (posix_memalign(&buf, 4096, len) != 0) {             // 页对齐，注册更友好
+        return -1;
+    }
+    if (verbs_mem_reg(ep, buf, len, access, mem) != 0) {
+        free(buf);
+        return -1;
+    }
+    mem->owned = 1;
+    return 0;
+}
+
+static void verbs_mem_dereg(rdma_ep_t *ep, rdma_mem_t *mem) {
+    (void)ep;
+    ibv_dereg_mr((struct ibv_mr *)mem->priv);
+    if (mem->owned) {
+        free(mem->addr);
+    }
+}
+
+static int verbs_post_recv(rdma_ep_t *ep, struct ibv_sge *sge, uint64_t wr_id) {
+    struct ibv_recv_wr wr;                                  // 接收 WR
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = sge;
+    wr.num_sge = 1;
+    struct ibv_recv_wr *bad = NULL;
+    return ibv_post_recv(vep(ep)->id->qp, &wr, &bad) == 0 ? 0 : -1;
+}
+
+static int verbs_post_send(rdma_ep_t *ep, struct ibv_sge *sge, int num_sge, uint64_t wr_id) {
+    struct ibv_send_wr wr;                                  // 发送 WR
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = sge;
+    wr.num_sge = num_sge;
+    wr.opcode = IBV_WR_SEND;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    struct ibv_send_wr *bad = NULL;
+    return ibv_post_send(vep(ep)->id->qp, &wr, &bad) == 0 ? 0 : -1;
+}
+
+static int verbs_post_rdma(rdma_ep_t *ep, enum ibv_wr_opcode op, struct ibv_sge *sge, int num_sge,
+                           uint64_t remote_addr, uint32_t rkey, uint32_t imm, uint64_t wr_id) {
+    struct ibv_send_wr wr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = wr_id;
+    wr.sg_list = sge;
+    wr.num_sge = num_sge;
+    wr.opcode = op;                                         // WRITE / WRITE_WITH_IMM / READ
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl(imm);                               // imm 在线上按网络字节序
+    wr.wr.rdma.remote_addr = remote_addr;
+    wr.wr.rdma.rkey = rkey;
+    struct ibv_send_wr *bad = NULL;
+    return ibv_post_send(vep(ep)->id->qp, &wr, &bad) == 0 ? 0 : -1;
+}
+
+static int verbs_post_batch(rdma_ep_t *ep, rdma_wr_batch_t *b) {
+    return rdma_post_wr_batch(vep(ep)->id->qp, b);          // 整条链一次门铃
+}
+
+// 批量取完成事件；imm_data 统一转成主机字节序交给上层
+static int verbs_poll(rdma_ep_t *ep, struct ibv_wc *wc, int max) {
+    int n = ibv_poll_cq(vep(ep)->cq, max, wc);
+    for (int i = 0; i < n; i++) {
+        if (wc[i].wc_flags & IBV_WC_WITH_IMM) {
+            wc[i].imm_data = ntohl(wc[i].imm_data);
+        }
+    }
+    return n;
+}
+
+static void verbs_close(rdma_ep_t *ep) {
+    verbs_ep_t *v = vep(ep);
+    if (!v) {
+        return;
+    }
+    rdma_disconnect(v->id);
+    rdma_destroy_qp(v->id);
+    rdma_destroy_id(v->id);
+    if (v->cq) {
+        ibv_destroy_cq(v->cq);
+    }
+    if (v->pd) {
+        ibv_dealloc_pd(v->pd);                              // MR 未全部注销时会失败，忽略即可
+    }
+    if (v->comp_chan) {
+        ibv_destroy_comp_channel(v->comp_chan);
+    }
+    if (v->own_ec) {
+        rdma_destroy_event_channel(v->ec);
+    }
+    free(v);
+    ep->priv = NULL;
+}
+
+const rdma_xport_ops_t rdma_xport_verbs_ops = {
+    .name = "verbs",
+    .create = verbs_create,
+    .connect = verbs_connect,
+    .listen = verbs_listen,
+    .get_request = verbs_get_request,
+    .accept = verbs_accept,
+    .close_listener = verbs_close_listener,
+    .listen_fd = verbs_listen_fd,
+    .mem_reg = verbs_mem_reg,
+    .mem_alloc = verbs_mem_alloc,
+    .mem_dereg = verbs_mem_dereg,
+    .post_recv = verbs_post_recv,
+    .post_send = verbs_post_send,
+    .post_rdma = verbs_post_rdma,
+    .post_batch = verbs_post_batch,
+    .poll = verbs_poll,
+    .close = verbs_close,
+};
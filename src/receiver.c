@@ -7,6 +7,8 @@
 #include <errno.h>
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <endian.h>
 
@@ -19,251 +21,730 @@ static int build_out_path(const char *dir, const char *name, char *out_path, siz
     return 0;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 4) {
-        fprintf(stderr, "Usage: %s <listen_ip> <port> <output_dir>\n", argv[0]);
-        return 1;
+// ===================== 小文件批量模式 =====================
+// 发送端把一批文件写进同一块区域：[索引项 * N][文件数据紧密排列]
+// 接收端收到 FIN 后按索引把区域拆回文件，多个线程并行落盘
+
+// 拆分落盘的并行线程数
+#define SPLIT_THREADS 4
+
+// 拆分任务：线程 k 负责下标 first, first + step, ...
+typedef struct {
+    const uint8_t *region;                    // 批量区域
+    const rdma_batch_entry_t *entries;        // 已校验的索引副本
+    uint64_t region_len;                      // 区域长度
+    uint32_t count;                           // 文件数量
+    const char *out_dir;                      // 输出目录
+    uint32_t first;                           // 起始下标
+    uint32_t step;                            // 步长（= 线程数）
+    int rc;                                   // 结果：0 成功
+} split_job_t;
+
+// 校验文件名：只允许单级文件名，拒绝 "."、".." 与带 '/' 的名字
+static int valid_name(const char *name, uint32_t name_len) {
+    if (name_len == 0 || name_len >= RDMA_MAX_NAME || strlen(name) != name_len) {
+        return 0;
     }
-    const char *listen_ip = argv[1];                                // 监听 IP
-    const char *port = argv[2];                                     // 监听端口
-    const char *out_dir = argv[3];                                  // 输出目录
+    if (strchr(name, '/') || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return 0;
+    }
+    return 1;
+}
 
-    // 1) 解析监听地址并创建监听 CM ID
-    // 说明：listen 端必须先 bind + listen，等待对端 connect
-    struct rdma_addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_flags = RAI_PASSIVE;                                   // 被动监听
-    hints.ai_port_space = RDMA_PS_TCP;
-
-    struct rdma_addrinfo *res = NULL;
-    if (rdma_getaddrinfo((char *)listen_ip, (char *)port, &hints, &res) != 0) {
-        perror("rdma_getaddrinfo");
-        return 1;
+// 拆分线程：把分到的索引项逐个写成文件（索引已由 check_index 校验过）
+static void *split_worker(void *arg) {
+    split_job_t *job = (split_job_t *)arg;
+    for (uint32_t i = job->first; i < job->count; i += job->step) {
+        const rdma_batch_entry_t *e = &job->entries[i];
+        uint64_t off = be64toh(e->offset);
+        uint64_t len = be64toh(e->length);
+        char out_path[1024];
+        if (build_out_path(job->out_dir, e->name, out_path, sizeof(out_path)) != 0) {
+            fprintf(stderr, "output path too long\n");
+            job->rc = -1;
+            continue;
+        }
+        // 先删掉旧文件再 O_EXCL 新建：本批名字唯一，若仍撞上说明有别人在写同一路径，报错而不是交错覆盖
+        if (unlink(out_path) != 0 && errno != ENOENT) {
+            perror(out_path);
+            job->rc = -1;
+            continue;
+        }
+        int fd = open(out_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+        if (!fp) {
+            perror(out_path);
+            if (fd >= 0) {
+                close(fd);
+            }
+            job->rc = -1;
+            continue;
+        }
+        size_t wn = fwrite(job->region + off, 1, (size_t)len, fp);
+        if (fclose(fp) != 0 || wn != (size_t)len) {
+            fprintf(stderr, "fwrite failed: %s\n", out_path);
+            job->rc = -1;
+        }
     }
+    return NULL;
+}
 
-    struct rdma_event_channel *ec = rdma_create_event_channel();
-    if (!ec) {
-        perror("rdma_create_event_channel");
-        rdma_freeaddrinfo(res);
-        return 1;
+static int cmp_entry_name(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// 校验整份索引（来自远端写入）：名字合法、数据不越界、本批内没有重名
+// 重名的两项会被两个拆分线程同时写到同一路径，必须在落盘前拒绝
+// 校验的是副本，成功时通过 out_entries 交给拆分线程使用（调用方释放）
+static int check_index(const uint8_t *region, uint64_t region_len, uint32_t count,
+                       rdma_batch_entry_t **out_entries) {
+    const rdma_batch_entry_t *entries = (const rdma_batch_entry_t *)region;
+    uint64_t index_len = (uint64_t)count * sizeof(rdma_batch_entry_t);
+    rdma_batch_entry_t *copy = (rdma_batch_entry_t *)malloc((size_t)index_len);
+    const char **names = (const char **)malloc((size_t)count * sizeof(*names));
+    if (!copy || !names) {
+        fprintf(stderr, "malloc failed\n");
+        free(copy);
+        free(names);
+        return -1;
+    }
+    memcpy(copy, entries, (size_t)index_len);               // 之后只用副本，远端再改区域也无效
+    int rc = 0;
+    for (uint32_t i = 0; i < count && rc == 0; i++) {
+        rdma_batch_entry_t *e = &copy[i];
+        e->name[RDMA_MAX_NAME - 1] = '\0';
+        uint64_t off = be64toh(e->offset);
+        uint64_t len = be64toh(e->length);
+        if (!valid_name(e->name, ntohl(e->name_len)) || off < index_len ||
+            off > region_len || len > region_len - off) {
+            fprintf(stderr, "invalid batch entry %u\n", i);
+            rc = -1;
+        }
+        names[i] = e->name;
     }
+    if (rc == 0) {
+        qsort(names, count, sizeof(*names), cmp_entry_name);
+        for (uint32_t i = 1; i < count; i++) {
+            if (strcmp(names[i - 1], names[i]) == 0) {
+                fprintf(stderr, "duplicate file name in batch: %s\n", names[i]);
+                rc = -1;
+                break;
+            }
+        }
+    }
+    free(names);
+    if (rc != 0) {
+        free(copy);
+        return -1;
+    }
+    *out_entries = copy;
+    return 0;
+}
 
-    struct rdma_cm_id *listen_id = NULL;
-    if (rdma_create_id(ec, &listen_id, NULL, RDMA_PS_TCP) != 0) {
-        perror("rdma_create_id");
-        rdma_freeaddrinfo(res);
-        rdma_destroy_event_channel(ec);
-        return 1;
+// 按索引把批量区域拆成文件（并行）
+static int split_batch(const uint8_t *region, uint64_t region_len, uint32_t count, const char *out_dir) {
+    if ((uint64_t)count * sizeof(rdma_batch_entry_t) > region_len) {
+        fprintf(stderr, "batch index exceeds region\n");
+        return -1;
+    }
+    rdma_batch_entry_t *entries = NULL;
+    if (check_index(region, region_len, count, &entries) != 0) {
+        return -1;
+    }
+    uint32_t nthreads = count < SPLIT_THREADS ? count : SPLIT_THREADS;
+    pthread_t tids[SPLIT_THREADS];
+    split_job_t jobs[SPLIT_THREADS];
+    uint32_t started = 0;
+    for (uint32_t t = 0; t < nthreads; t++) {
+        jobs[t].region = region;
+        jobs[t].entries = entries;
+        jobs[t].region_len = region_len;
+        jobs[t].count = count;
+        jobs[t].out_dir = out_dir;
+        jobs[t].first = t;
+        jobs[t].step = nthreads;
+        jobs[t].rc = 0;
+        if (pthread_create(&tids[t], NULL, split_worker, &jobs[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started < nthreads) {
+        // 线程创建失败：剩余下标在当前线程内串行处理
+        for (uint32_t t = started; t < nthreads; t++) {
+            split_worker(&jobs[t]);
+        }
+    }
+    int rc = 0;
+    for (uint32_t t = 0; t < nthreads; t++) {
+        if (t < started) {
+            pthread_join(tids[t], NULL);
+        }
+        if (jobs[t].rc != 0) {
+            rc = -1;
+        }
     }
+    free(entries);
+    return rc;
+}
 
-    if (rdma_bind_addr(listen_id, res->ai_src_addr) != 0) {
-        perror("rdma_bind_addr");
-        rdma_freeaddrinfo(res);
-        rdma_destroy_id(listen_id);
-        rdma_destroy_event_channel(ec);
-        return 1;
+// 批量模式主循环：每批 BATCH -> MR -> (数据写入) -> FIN -> 拆分落盘 -> ACK
+// first：已经收到的第一条 BATCH 消息
+// more：最后一批声明的、随后另起连接发送的单文件个数
+static int recv_batches(rdma_disp_t *d, const char *out_dir, const rdma_ctrl_batch_t *first,
+                        uint32_t *more) {
+    rdma_ep_t *ep = d->ep;
+    // 控制消息缓冲区（每批复用）
+    struct {
+        rdma_ctrl_batch_t batch;
+        rdma_ctrl_mr_t mr_info;
+        rdma_ctrl_simple_t fin;
+        rdma_ctrl_simple_t ack;
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    memcpy(&ctrl.batch, first, sizeof(ctrl.batch));
+    rdma_mem_t ctrl_mem;
+    if (rdma_mem_reg(ep, &ctrl, sizeof(ctrl), IBV_ACCESS_LOCAL_WRITE, &ctrl_mem) != 0) {
+        fprintf(stderr, "register ctrl MR failed\n");
+        return -1;
     }
-    rdma_freeaddrinfo(res);
 
-    if (rdma_listen(listen_id, 1) != 0) {
-        perror("rdma_listen");
-        rdma_destroy_id(listen_id);
-        rdma_destroy_event_channel(ec);
-        return 1;
+    uint64_t files = 0;
+    int batches = 0;
+    int rc = -1;
+    rdma_req_t r_batch = {0};                               // 下一条 BATCH 的接收
+    while (1) {
+        uint32_t count = ntohl(ctrl.batch.file_count);
+        uint64_t total = be64toh(ctrl.batch.total_size);
+        int last = (ntohl(ctrl.batch.flags) & RDMA_BATCH_F_LAST) != 0;
+        // 只有最后一批可以为空（全是大文件时发送端只发一条声明）
+        if ((count == 0 && !last) || count > RDMA_BATCH_MAX_FILES ||
+            total < (uint64_t)count * sizeof(rdma_batch_entry_t)) {
+            fprintf(stderr, "invalid BATCH\n");
+            break;
+        }
+
+        // 1) 分配并注册批量区域（远端可写）
+        rdma_mem_t region_mem;
+        if (rdma_mem_alloc(ep, (size_t)total,
+                           IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE, &region_mem) != 0) {
+            fprintf(stderr, "register batch MR failed\n");
+            break;
+        }
+        uint8_t *region = (uint8_t *)region_mem.addr;
+
+        // 2) 先挂 FIN 接收，再回 MR 信息
+        ctrl.mr_info.type = htonl(RDMA_CTRL_MR);
+        ctrl.mr_info.addr = htobe64((uint64_t)(uintptr_t)region);
+        ctrl.mr_info.rkey = htonl(region_mem.rkey);
+        ctrl.mr_info.length = htobe64(total);
+        rdma_req_t r_fin = {0}, r_mr = {0}, r_ack = {0};
+        int ok = rdma_disp_post_recv(d, &r_fin, &ctrl.fin, sizeof(ctrl.fin), &ctrl_mem) == 0 &&
+                 rdma_disp_post_send(d, &r_mr, &ctrl.mr_info, sizeof(ctrl.mr_info), &ctrl_mem) == 0 &&
+                 rdma_disp_wait(d, &r_mr) == 0 &&
+                 rdma_disp_wait(d, &r_fin) == 0 &&
+                 ntohl(ctrl.fin.type) == RDMA_CTRL_FIN;
+        if (!ok) {
+            fprintf(stderr, "MR_INFO/FIN exchange failed\n");
+        }
+
+        // 3) 数据已全部写入：按索引拆分落盘
+        if (ok && count > 0 && split_batch(region, total, count, out_dir) != 0) {
+            ok = 0;
+        }
+        rdma_mem_dereg(ep, &region_mem);
+        if (!ok) {
+            break;
+        }
+        files += count;
+        batches++;
+
+        // 4) 非最后一批：先挂下一条 BATCH 的接收，再回 ACK
+        if (!last &&
+            rdma_disp_post_recv(d, &r_batch, &ctrl.batch, sizeof(ctrl.batch), &ctrl_mem) != 0) {
+            fprintf(stderr, "post recv BATCH failed\n");
+            break;
+        }
+        ctrl.ack.type = htonl(RDMA_CTRL_ACK);
+        if (rdma_disp_post_send(d, &r_ack, &ctrl.ack, sizeof(ctrl.ack), &ctrl_mem) != 0 ||
+            rdma_disp_wait(d, &r_ack) != 0) {
+            fprintf(stderr, "ACK send failed\n");
+            break;
+        }
+        if (last) {
+            *more = ntohl(ctrl.batch.more);
+            rc = 0;
+            break;
+        }
+
+        // 5) 等待下一批
+        if (rdma_disp_wait(d, &r_batch) != 0 || ntohl(ctrl.batch.type) != RDMA_CTRL_BATCH) {
+            fprintf(stderr, "BATCH recv failed\n");
+            break;
+        }
+    }
+    rdma_mem_dereg(ep, &ctrl_mem);
+    if (rc == 0) {
+        printf("[receiver] saved %llu files in %d batches to %s\n",
+               (unsigned long long)files, batches, out_dir);
     }
-    printf("[receiver] listening on %s:%s\n", listen_ip, port);
+    return rc;
+}
 
-    // 2) 等待连接请求（CM 事件）
-    struct rdma_cm_id *id = NULL;
-    if (rdma_wait_event(ec, RDMA_CM_EVENT_CONNECT_REQUEST, &id) != 0) {
-        fprintf(stderr, "CONNECT_REQUEST failed\n");
-        rdma_destroy_id(listen_id);
-        rdma_destroy_event_channel(ec);
-        return 1;
+// ===================== 链式复制 =====================
+// sender -> R1 -> R2 -> ... -> Rn：发送端只写第一跳，中继节点边收边转发
+// - 中继在 MR 中置 RDMA_MR_F_NOTIFY，发送端改用 Write with Imm（imm = 块序号）
+// - 每收到一个块的通知，立即用自己的 RDMA Write 把该块写给下一跳
+// - FIN 沿链向下传，ACK 沿链逐跳返回：最后一跳落盘后，ACK 才回到发送端
+// 发送端出口流量与副本数无关，总耗时接近单次传输 + 每跳一个块的流水线延迟
+
+#define RELAY_RECV_DEPTH 8                    // 上游通知的 Recv 预投递数（不超过 QP 接收深度）
+#define RELAY_WINDOW 8                        // 向下一跳在途的 Write 上限（不超过 QP 发送深度）
+
+// 下一跳
+typedef struct {
+    rdma_ep_t *ep;
+    rdma_disp_t disp;
+    struct {
+        rdma_ctrl_hello_t hello;
+        rdma_ctrl_mr_t mr_info;
+        rdma_ctrl_simple_t fin;
+        rdma_ctrl_simple_t ack;
+    } ctrl;
+    rdma_mem_t ctrl_mem;
+    rdma_mem_t data_mem;                      // 本地文件在下一跳端点上的注册（转发的源）
+    uint8_t *data;                            // 本地文件内容（与上游写入的是同一份）
+    uint64_t remote_addr;
+    uint32_t rkey;
+    int notify;                               // 下一跳也是中继：转发时带 Imm
+    rdma_req_t r_write[RELAY_WINDOW];         // 在途的转发 Write（按序号轮转复用）
+    uint64_t posted;                          // 已投递的转发 Write 数
+} chain_t;
+
+static void chain_close(chain_t *c) {
+    if (!c->ep) {
+        return;
     }
+    rdma_mem_dereg(c->ep, &c->data_mem);
+    rdma_mem_dereg(c->ep, &c->ctrl_mem);
+    rdma_ep_close(c->ep);
+    c->ep = NULL;
+}
 
-    // 3) 创建 QP/CQ/PD
-    struct ibv_pd *pd = NULL;
-    struct ibv_cq *cq = NULL;
-    struct ibv_comp_channel *comp_chan = NULL;
-    if (rdma_build_qp(id, &pd, &cq, &comp_chan) != 0) {
-        fprintf(stderr, "rdma_build_qp failed\n");
-        rdma_destroy_id(id);
-        rdma_destroy_id(listen_id);
-        rdma_destroy_event_channel(ec);
-        return 1;
+// 连接下一跳：转发 HELLO，拿到它的 MR
+static int chain_open(chain_t *c, rdma_xport_kind_t kind, const char *ip, const char *port,
+                      const rdma_ctrl_hello_t *hello) {
+    memset(c, 0, sizeof(*c));
+    if (rdma_ep_create(kind, ip, port, &c->ep) != 0) {
+        fprintf(stderr, "create next-hop endpoint failed\n");
+        return -1;
+    }
+    rdma_disp_init(&c->disp, c->ep);
+    memcpy(&c->ctrl.hello, hello, sizeof(c->ctrl.hello));
+    c->ctrl.fin.type = htonl(RDMA_CTRL_FIN);
+    rdma_req_t r_mr = {0}, r_hello = {0};
+    if (rdma_mem_reg(c->ep, &c->ctrl, sizeof(c->ctrl), IBV_ACCESS_LOCAL_WRITE, &c->ctrl_mem) != 0 ||
+        rdma_disp_post_recv(&c->disp, &r_mr, &c->ctrl.mr_info, sizeof(c->ctrl.mr_info),
+                            &c->ctrl_mem) != 0 ||
+        rdma_ep_connect(c->ep) != 0) {
+        fprintf(stderr, "connect next hop %s:%s failed\n", ip, port);
+        chain_close(c);
+        return -1;
+    }
+    printf("[receiver] next hop %s:%s via %s\n", ip, port, rdma_xport_name(rdma_ep_kind(c->ep)));
+    if (rdma_disp_post_send(&c->disp, &r_hello, &c->ctrl.hello, sizeof(c->ctrl.hello),
+                            &c->ctrl_mem) != 0 ||
+        rdma_disp_wait(&c->disp, &r_hello) != 0 ||
+        rdma_disp_wait(&c->disp, &r_mr) != 0 ||
+        ntohl(c->ctrl.mr_info.type) != RDMA_CTRL_MR ||
+        be64toh(c->ctrl.mr_info.length) < be64toh(hello->file_size)) {
+        fprintf(stderr, "next hop HELLO/MR exchange failed\n");
+        chain_close(c);
+        return -1;
     }
+    c->remote_addr = be64toh(c->ctrl.mr_info.addr);
+    c->rkey = ntohl(c->ctrl.mr_info.rkey);
+    c->notify = (ntohl(c->ctrl.mr_info.flags) & RDMA_MR_F_NOTIFY) != 0;
+    return 0;
+}
 
-    // 4) 预投递 HELLO 接收
-    // 说明：控制面走 Send/Recv，必须先 post_recv
-    rdma_ctrl_hello_t hello;
-    memset(&hello, 0, sizeof(hello));
-    struct ibv_mr *hello_mr = NULL;
-    if (rdma_register_mr(pd, &hello, sizeof(hello), IBV_ACCESS_LOCAL_WRITE, &hello_mr) != 0) {
-        fprintf(stderr, "register HELLO MR failed\n");
-        return 1;
+// 把本地文件注册到下一跳端点上作为转发源
+// 数据已直接落进文件（RDMA_MEM_F_DIRECT）时注册文件本身，tcp 可直接 sendfile；
+// 否则数据在内存里，直接注册那块内存
+static int chain_attach(chain_t *c, const rdma_mem_t *file_mem, int out_fd, uint64_t size) {
+    int rc;
+    if (file_mem->flags & RDMA_MEM_F_DIRECT) {
+        rc = rdma_mem_reg_file(c->ep, out_fd, (size_t)size, 0, &c->data_mem);
+    } else {
+        rc = rdma_mem_reg(c->ep, file_mem->addr, file_mem->length, 0, &c->data_mem);
     }
-    if (rdma_post_recv(id, &hello, sizeof(hello), hello_mr, 1) != 0) {
-        fprintf(stderr, "post recv HELLO failed\n");
-        return 1;
+    if (rc != 0) {
+        fprintf(stderr, "register forward MR failed\n");
+        return -1;
     }
+    c->data = (uint8_t *)c->data_mem.addr;
+    return 0;
+}
 
-    // 5) 接受连接
-    struct rdma_conn_param conn_param;
-    memset(&conn_param, 0, sizeof(conn_param));
-    conn_param.initiator_depth = 1;
-    conn_param.responder_resources = 1;
-    conn_param.rnr_retry_count = 7;
-    if (rdma_accept(id, &conn_param) != 0) {
-        perror("rdma_accept");
-        return 1;
+// 转发一个块（窗口满时先等最早的那个 Write 完成）
+static int chain_forward(chain_t *c, uint32_t idx, uint64_t offset, uint32_t len) {
+    rdma_req_t *w = &c->r_write[c->posted % RELAY_WINDOW];
+    if (c->posted >= RELAY_WINDOW && rdma_disp_wait(&c->disp, w) != 0) {
+        fprintf(stderr, "forward write completion failed\n");
+        return -1;
     }
-    if (rdma_wait_event(ec, RDMA_CM_EVENT_ESTABLISHED, NULL) != 0) {
-        fprintf(stderr, "ESTABLISHED failed\n");
-        return 1;
+    struct ibv_sge sge;
+    sge.addr = (uintptr_t)(c->data + offset);
+    sge.length = len;
+    sge.lkey = c->data_mem.lkey;
+    int rc = c->notify
+        ? rdma_disp_post_write_imm(&c->disp, w, &sge, 1, c->remote_addr + offset, c->rkey, idx)
+        : rdma_disp_post_write(&c->disp, w, &sge, 1, c->remote_addr + offset, c->rkey);
+    if (rc != 0) {
+        fprintf(stderr, "post forward write failed\n");
+        return -1;
     }
+    c->posted++;
+    return 0;
+}
 
-    // 6) 等待 HELLO 到达
-    if (rdma_poll_cq(cq, IBV_WC_RECV, NULL) != 0) {
-        fprintf(stderr, "HELLO recv completion failed\n");
-        return 1;
+// 向下一跳发 FIN（RC 保序，不必先等转发写完），再等它的 ACK
+static int chain_finish(chain_t *c) {
+    rdma_req_t r_ack = {0}, r_fin = {0};
+    if (rdma_disp_post_recv(&c->disp, &r_ack, &c->ctrl.ack, sizeof(c->ctrl.ack), &c->ctrl_mem) != 0 ||
+        rdma_disp_post_send(&c->disp, &r_fin, &c->ctrl.fin, sizeof(c->ctrl.fin), &c->ctrl_mem) != 0 ||
+        rdma_disp_drain(&c->disp) != 0 ||
+        ntohl(c->ctrl.ack.type) != RDMA_CTRL_ACK) {
+        fprintf(stderr, "next hop FIN/ACK failed\n");
+        return -1;
     }
+    return 0;
+}
 
-    if (ntohl(hello.type) != RDMA_CTRL_HELLO) {
-        fprintf(stderr, "invalid HELLO type\n");
-        return 1;
+// 中继状态：上游通知 / FIN 的接收环
+typedef struct {
+    rdma_disp_t *up;                          // 上游分发器
+    chain_t *chain;
+    rdma_ctrl_simple_t ring[RELAY_RECV_DEPTH];
+    rdma_req_t req[RELAY_RECV_DEPTH];
+    rdma_mem_t ring_mem;
+    uint64_t file_size;
+    uint64_t chunks;                          // 已转发的块数
+    int fin;                                  // 已收到上游 FIN
+    int err;
+} relay_t;
+
+// 上游 Recv 完成：块通知则立即转发并重新挂接收；FIN 则结束
+// 完成事件按到达顺序分发，FIN 一定排在它之前的所有块通知之后
+static void relay_on_recv(rdma_req_t *req, const struct ibv_wc *wc) {
+    relay_t *r = (relay_t *)req->arg;
+    int slot = (int)(req - r->req);
+    if (r->err || wc->status != IBV_WC_SUCCESS) {
+        r->err = 1;
+        return;
+    }
+    if (wc->opcode == IBV_WC_RECV) {
+        if (ntohl(r->ring[slot].type) != RDMA_CTRL_FIN) {
+            fprintf(stderr, "invalid FIN type\n");
+            r->err = 1;
+            return;
+        }
+        r->fin = 1;                                         // FIN 之后不会再有通知
+        return;
+    }
+    uint64_t offset = (uint64_t)wc->imm_data * RDMA_CHUNK;
+    if (offset + wc->byte_len > r->file_size) {
+        fprintf(stderr, "chunk %u out of range\n", wc->imm_data);
+        r->err = 1;
+        return;
     }
+    if (chain_forward(r->chain, wc->imm_data, offset, wc->byte_len) != 0 ||
+        rdma_disp_post_recv(r->up, req, &r->ring[slot], sizeof(r->ring[slot]), &r->ring_mem) != 0) {
+        r->err = 1;
+        return;
+    }
+    r->chunks++;
+}
 
-    uint32_t name_len = ntohl(hello.name_len);
-    uint64_t file_size = be64toh(hello.file_size);
-    if (name_len == 0 || name_len >= RDMA_MAX_NAME) {
-        fprintf(stderr, "invalid file name length\n");
-        return 1;
+// 中继主循环：回 MR（带 NOTIFY），按通知逐块转发，直到上游 FIN
+// mr_info 已填好地址/rkey；返回时下一跳已确认落盘
+static int relay_file(rdma_disp_t *up, rdma_ctrl_mr_t *mr_info, rdma_mem_t *ctrl_mem,
+                      uint64_t file_size, chain_t *c) {
+    relay_t r;
+    memset(&r, 0, sizeof(r));
+    r.up = up;
+    r.chain = c;
+    r.file_size = file_size;
+    if (rdma_mem_reg(up->ep, r.ring, sizeof(r.ring), IBV_ACCESS_LOCAL_WRITE, &r.ring_mem) != 0) {
+        fprintf(stderr, "register relay ring failed\n");
+        return -1;
+    }
+    int rc = -1;
+    rdma_req_t r_mr = {0};
+    for (int i = 0; i < RELAY_RECV_DEPTH; i++) {
+        r.req[i].cb = relay_on_recv;
+        r.req[i].arg = &r;
+        if (rdma_disp_post_recv(up, &r.req[i], &r.ring[i], sizeof(r.ring[i]), &r.ring_mem) != 0) {
+            fprintf(stderr, "post relay recv failed\n");
+            goto out;
+        }
+    }
+    mr_info->flags = htonl(RDMA_MR_F_NOTIFY);
+    if (rdma_disp_post_send(up, &r_mr, mr_info, sizeof(*mr_info), ctrl_mem) != 0) {
+        fprintf(stderr, "post send MR_INFO failed\n");
+        goto out;
     }
-    hello.name[RDMA_MAX_NAME - 1] = '\0';
-    printf("[receiver] incoming file: %s (%llu bytes)\n",
-           hello.name, (unsigned long long)file_size);
 
-    // 7) 为文件数据分配 MR
-    // 关键点：必须给远端写权限（IBV_ACCESS_REMOTE_WRITE）
-    uint8_t *file_buf = (uint8_t *)malloc((size_t)file_size);
-    if (!file_buf) {
-        fprintf(stderr, "malloc failed\n");
-        return 1;
+    int idle = 0;
+    while (!r.fin && !r.err) {
+        int n = rdma_disp_poll(up);                         // 分发时回调里完成转发
+        if (n < 0 || rdma_disp_poll(&c->disp) < 0) {        // 顺带回收下一跳的完成事件
+            goto out;
+        }
+        if (n > 0) {
+            idle = 0;
+        } else if (++idle > RDMA_DISP_SPIN) {
+            usleep(50);
+        }
     }
+    if (r.err || rdma_disp_wait(up, &r_mr) != 0 || chain_finish(c) != 0) {
+        goto out;
+    }
+    printf("[receiver] forwarded %llu chunks\n", (unsigned long long)r.chunks);
+    rc = 0;
 
-    struct ibv_mr *file_mr = NULL;
-    if (rdma_register_mr(pd, file_buf, (size_t)file_size,
-                         IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE, &file_mr) != 0) {
-        fprintf(stderr, "register file MR failed\n");
-        free(file_buf);
-        return 1;
+out:
+    // FIN 之后剩余的接收不会再完成，撤销登记，免得分发器持有失效的栈上指针
+    for (int i = 0; i < RELAY_RECV_DEPTH; i++) {
+        if (!r.req[i].done) {
+            rdma_disp_untrack(up, r.req[i].wr_id);
+        }
     }
+    rdma_mem_dereg(up->ep, &r.ring_mem);
+    return rc;
+}
 
-    // 8) 发送 MR 信息给发送端
-    rdma_ctrl_mr_t mr_info;
-    memset(&mr_info, 0, sizeof(mr_info));
-    mr_info.type = htonl(RDMA_CTRL_MR);
-    mr_info.addr = htobe64((uint64_t)(uintptr_t)file_buf);
-    mr_info.rkey = htonl(file_mr->rkey);
-    mr_info.length = htobe64((uint64_t)file_size);
+// 处理一个连接：单文件（HELLO）或批量（BATCH）
+// 批量会话结束时由 more 带回随后还有几个单文件连接（发送端把大文件拆出去走分块路径）
+static int serve_session(rdma_listener_t *ln, rdma_xport_kind_t kind, const char *out_dir,
+                         const char *next_ip, const char *next_port, uint32_t *more) {
+    *more = 0;
+    // 2) 等待连接请求，得到已建好 QP/CQ/PD 的端点
+    rdma_ep_t *ep = NULL;
+    if (rdma_listener_get_request(ln, &ep) != 0) {
+        fprintf(stderr, "CONNECT_REQUEST failed\n");
+        return -1;
+    }
 
-    struct ibv_mr *mr_info_mr = NULL;
-    if (rdma_register_mr(pd, &mr_info, sizeof(mr_info), IBV_ACCESS_LOCAL_WRITE, &mr_info_mr) != 0) {
-        fprintf(stderr, "register MR_INFO MR failed\n");
-        free(file_buf);
-        return 1;
+    // 3) 预投递 HELLO 接收
+    // 说明：控制面走 Send/Recv，必须先 post_recv
+    // hello 缓冲区同时用于接收 BATCH（批量模式的第一条消息）
+    struct {
+        rdma_ctrl_hello_t hello;
+        rdma_ctrl_mr_t mr_info;
+        rdma_ctrl_simple_t fin;
+        rdma_ctrl_simple_t ack;
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    rdma_mem_t ctrl_mem;
+    if (rdma_mem_reg(ep, &ctrl, sizeof(ctrl), IBV_ACCESS_LOCAL_WRITE, &ctrl_mem) != 0) {
+        fprintf(stderr, "register ctrl MR failed\n");
+        return -1;
     }
-    if (rdma_post_send(id, &mr_info, sizeof(mr_info), mr_info_mr, 2) != 0) {
-        fprintf(stderr, "post send MR_INFO failed\n");
-        free(file_buf);
-        return 1;
+    rdma_disp_t disp;
+    rdma_disp_init(&disp, ep);
+    rdma_req_t r_hello = {0}, r_mr = {0}, r_fin = {0}, r_ack = {0};
+    if (rdma_disp_post_recv(&disp, &r_hello, &ctrl.hello, sizeof(ctrl.hello), &ctrl_mem) != 0) {
+        fprintf(stderr, "post recv HELLO failed\n");
+        return -1;
     }
-    if (rdma_poll_cq(cq, IBV_WC_SEND, NULL) != 0) {
-        fprintf(stderr, "MR_INFO send completion failed\n");
-        free(file_buf);
-        return 1;
+
+    // 4) 接受连接
+    if (rdma_ep_accept(ep) != 0) {
+        fprintf(stderr, "accept failed\n");
+        return -1;
     }
+    printf("[receiver] connected via %s\n", rdma_xport_name(rdma_ep_kind(ep)));
 
-    // 9) 预投递 FIN 接收
-    // 说明：写入完成后，发送端会发送 FIN 通知
-    rdma_ctrl_simple_t fin;
-    memset(&fin, 0, sizeof(fin));
-    struct ibv_mr *fin_mr = NULL;
-    if (rdma_register_mr(pd, &fin, sizeof(fin), IBV_ACCESS_LOCAL_WRITE, &fin_mr) != 0) {
-        fprintf(stderr, "register FIN MR failed\n");
-        free(file_buf);
-        return 1;
+    // 5) 等待 HELLO 到达
+    if (rdma_disp_wait(&disp, &r_hello) != 0) {
+        fprintf(stderr, "HELLO recv completion failed\n");
+        return -1;
     }
-    if (rdma_post_recv(id, &fin, sizeof(fin), fin_mr, 3) != 0) {
-        fprintf(stderr, "post recv FIN failed\n");
-        free(file_buf);
-        return 1;
+
+    // 第一条消息是 BATCH：进入小文件批量模式
+    if (ntohl(ctrl.hello.type) == RDMA_CTRL_BATCH) {
+        if (next_ip) {
+            fprintf(stderr, "chain replication supports single-file transfers only\n");
+            return -1;
+        }
+        rdma_ctrl_batch_t first;
+        memcpy(&first, &ctrl.hello, sizeof(first));
+        int rc = recv_batches(&disp, out_dir, &first, more);
+        rdma_mem_dereg(ep, &ctrl_mem);
+        rdma_ep_close(ep);
+        return rc;
     }
 
-    // 10) 等待 FIN 到达
-    if (rdma_poll_cq(cq, IBV_WC_RECV, NULL) != 0) {
-        fprintf(stderr, "FIN recv completion failed\n");
-        free(file_buf);
-        return 1;
+    if (ntohl(ctrl.hello.type) != RDMA_CTRL_HELLO) {
+        fprintf(stderr, "invalid HELLO type\n");
+        return -1;
     }
-    if (ntohl(fin.type) != RDMA_CTRL_FIN) {
-        fprintf(stderr, "invalid FIN type\n");
-        free(file_buf);
-        return 1;
+
+    uint32_t name_len = ntohl(ctrl.hello.name_len);
+    uint64_t file_size = be64toh(ctrl.hello.file_size);
+    if (name_len == 0 || name_len >= RDMA_MAX_NAME) {
+        fprintf(stderr, "invalid file name length\n");
+        return -1;
     }
+    ctrl.hello.name[RDMA_MAX_NAME - 1] = '\0';
+    printf("[receiver] incoming file: %s (%llu bytes)\n",
+           ctrl.hello.name, (unsigned long long)file_size);
 
-    // 11) 落盘保存
+    // 6) 打开输出文件，并以它为落点分配 MR
+    // 关键点：必须给远端写权限（IBV_ACCESS_REMOTE_WRITE）
+    // 用 rdma_mem_alloc_file：tcp 后端把数据直接 splice 进文件，
+    // 其他后端写入内存，收到 FIN 后由 rdma_mem_flush 落盘
+    if (!valid_name(ctrl.hello.name, name_len)) {           // 先校验再创建文件
+        fprintf(stderr, "invalid file name\n");
+        return -1;
+    }
     char out_path[1024];
-    if (build_out_path(out_dir, hello.name, out_path, sizeof(out_path)) != 0) {
+    if (build_out_path(out_dir, ctrl.hello.name, out_path, sizeof(out_path)) != 0) {
         fprintf(stderr, "output path too long\n");
-        free(file_buf);
-        return 1;
+        return -1;
     }
-    FILE *fp = fopen(out_path, "wb");
-    if (!fp) {
-        perror("fopen");
-        free(file_buf);
-        return 1;
+    int out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+        perror("open");
+        return -1;
     }
-    size_t wn = fwrite(file_buf, 1, (size_t)file_size, fp);
-    fclose(fp);
-    if (wn != (size_t)file_size) {
-        fprintf(stderr, "fwrite failed\n");
-        free(file_buf);
-        return 1;
+    rdma_mem_t file_mem;
+    if (rdma_mem_alloc_file(ep, out_fd, (size_t)file_size,
+                            IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE, &file_mem) != 0) {
+        fprintf(stderr, "register file MR failed\n");
+        close(out_fd);
+        return -1;
     }
-    printf("[receiver] saved to %s\n", out_path);
+    uint8_t *file_buf = (uint8_t *)file_mem.addr;
 
-    // 12) 发送 ACK
-    rdma_ctrl_simple_t ack;
-    memset(&ack, 0, sizeof(ack));
-    ack.type = htonl(RDMA_CTRL_ACK);
-    struct ibv_mr *ack_mr = NULL;
-    if (rdma_register_mr(pd, &ack, sizeof(ack), IBV_ACCESS_LOCAL_WRITE, &ack_mr) != 0) {
-        fprintf(stderr, "register ACK MR failed\n");
-        free(file_buf);
-        return 1;
+    // 链式复制：先连上下一跳并拿到它的 MR，再给上游回 MR
+    chain_t chain;
+    memset(&chain, 0, sizeof(chain));
+    if (next_ip && (chain_open(&chain, kind, next_ip, next_port, &ctrl.hello) != 0 ||
+                    chain_attach(&chain, &file_mem, out_fd, file_size) != 0)) {
+        goto fail;
+    }
+
+    ctrl.mr_info.type = htonl(RDMA_CTRL_MR);
+    ctrl.mr_info.addr = htobe64((uint64_t)(uintptr_t)file_buf);
+    ctrl.mr_info.rkey = htonl(file_mem.rkey);
+    ctrl.mr_info.length = htobe64((uint64_t)file_size);
+    if (next_ip) {
+        // 7/8) 中继：边收边转发，直到 FIN 传到链尾、ACK 逐跳返回
+        if (relay_file(&disp, &ctrl.mr_info, &ctrl_mem, file_size, &chain) != 0) {
+            goto fail;
+        }
+    } else {
+        // 7) 预投递 FIN 接收，再发送 MR 信息给发送端
+        // 说明：写入完成后，发送端会发送 FIN 通知
+        if (rdma_disp_post_recv(&disp, &r_fin, &ctrl.fin, sizeof(ctrl.fin), &ctrl_mem) != 0) {
+            fprintf(stderr, "post recv FIN failed\n");
+            goto fail;
+        }
+        if (rdma_disp_post_send(&disp, &r_mr, &ctrl.mr_info, sizeof(ctrl.mr_info), &ctrl_mem) != 0) {
+            fprintf(stderr, "post send MR_INFO failed\n");
+            goto fail;
+        }
+        if (rdma_disp_wait(&disp, &r_mr) != 0) {
+            fprintf(stderr, "MR_INFO send completion failed\n");
+            goto fail;
+        }
+
+        // 8) 等待 FIN 到达
+        if (rdma_disp_wait(&disp, &r_fin) != 0) {
+            fprintf(stderr, "FIN recv completion failed\n");
+            goto fail;
+        }
+        if (ntohl(ctrl.fin.type) != RDMA_CTRL_FIN) {
+            fprintf(stderr, "invalid FIN type\n");
+            goto fail;
+        }
+    }
+
+    // 9) 落盘保存（数据已直接落到文件时为空操作）
+    if (rdma_mem_flush(ep, &file_mem) != 0) {
+        fprintf(stderr, "write %s failed\n", out_path);
+        goto fail;
     }
-    if (rdma_post_send(id, &ack, sizeof(ack), ack_mr, 4) != 0) {
+    printf("[receiver] saved to %s\n", out_path);
+
+    // 10) 发送 ACK
+    ctrl.ack.type = htonl(RDMA_CTRL_ACK);
+    if (rdma_disp_post_send(&disp, &r_ack, &ctrl.ack, sizeof(ctrl.ack), &ctrl_mem) != 0) {
         fprintf(stderr, "post send ACK failed\n");
-        free(file_buf);
-        return 1;
+        goto fail;
     }
-    if (rdma_poll_cq(cq, IBV_WC_SEND, NULL) != 0) {
+    if (rdma_disp_wait(&disp, &r_ack) != 0) {
         fprintf(stderr, "ACK send completion failed\n");
-        free(file_buf);
+        goto fail;
+    }
+
+    // 11) 断开连接并清理资源
+    chain_close(&chain);
+    rdma_mem_dereg(ep, &file_mem);
+    close(out_fd);
+    rdma_mem_dereg(ep, &ctrl_mem);
+    rdma_ep_close(ep);
+    return 0;
+
+fail:
+    chain_close(&chain);
+    rdma_mem_dereg(ep, &file_mem);
+    close(out_fd);
+    rdma_mem_dereg(ep, &ctrl_mem);
+    rdma_ep_close(ep);
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4 && argc != 6) {
+        fprintf(stderr, "Usage: %s <listen_ip> <port> <output_dir> [<next_ip> <next_port>]\n", argv[0]);
+        return 1;
+    }
+    const char *listen_ip = argv[1];                                // 监听 IP
+    const char *port = argv[2];                                     // 监听端口
+    const char *out_dir = argv[3];                                  // 输出目录
+    const char *next_ip = argc == 6 ? argv[4] : NULL;               // 链式复制：下一跳（可选）
+    const char *next_port = argc == 6 ? argv[5] : NULL;
+
+    rdma_xport_kind_t kind;                                         // 传输后端（RDMA_SIM_TRANSPORT）
+    if (rdma_xport_from_env(&kind) != 0) {
         return 1;
     }
 
-    // 13) 断开连接并清理资源
-    rdma_disconnect(id);
-    rdma_destroy_qp(id);
-    rdma_destroy_id(id);
-    rdma_destroy_id(listen_id);
-    rdma_destroy_event_channel(ec);
-    free(file_buf);
+    // 1) 监听
+    // 说明：listen 端必须先 bind + listen，等待对端 connect
+    rdma_listener_t *ln = NULL;
+    if (rdma_listener_create(kind, listen_ip, port, &ln) != 0) {
+        fprintf(stderr, "listen via %s failed\n", rdma_xport_name(kind));
+        return 1;
+    }
+    printf("[receiver] listening on %s:%s (%s)\n", listen_ip, port, rdma_xport_name(kind));
 
+    // 2) 逐个处理连接：通常只有一个；批量会话声明了后续单文件连接时继续接受
+    uint32_t more = 0;
+    int rc = serve_session(ln, kind, out_dir, next_ip, next_port, &more);
+    while (rc == 0 && more > 0) {
+        uint32_t extra = 0;
+        more--;
+        rc = serve_session(ln, kind, out_dir, next_ip, next_port, &extra);
+        more += extra;
+    }
+    rdma_listener_close(ln);
+    if (rc != 0) {
+        return 1;
+    }
     printf("[receiver] done\n");
     return 0;
 }
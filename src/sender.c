@@ -6,312 +6,745 @@
 #include <stdint.h>
 #include <errno.h>
 #include <libgen.h>
+#include <time.h>
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <endian.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 
-// 读取文件到内存
-// 目的：一次性读入文件内容，后续做 RDMA Write
-// 注意：真实场景可做零拷贝或分块读，这里为了教学简单化
-static int read_file(const char *path, uint8_t **out_buf, size_t *out_len, char *out_name, size_t name_cap) {
-    FILE *fp = fopen(path, "rb");                         // 以二进制方式打开文件
-    if (!fp) {
-        perror("fopen");                                  // 打印错误
-        return -1;
-    }
-    if (fseek(fp, 0, SEEK_END) != 0) {                      // 移动到文件末尾
-        perror("fseek");
-        fclose(fp);
-        return -1;
-    }
-    long fsize = ftell(fp);                                 // 获取文件大小
-    if (fsize < 0) {
-        perror("ftell");
-        fclose(fp);
-        return -1;
-    }
-    rewind(fp);                                             // 回到文件开头
-
-    uint8_t *buf = (uint8_t *)malloc((size_t)fsize);        // 分配缓冲区
-    if (!buf) {
-        fprintf(stderr, "malloc failed\n");
-        fclose(fp);
-        return -1;
-    }
-    size_t n = fread(buf, 1, (size_t)fsize, fp);            // 读取文件
-    fclose(fp);
-    if (n != (size_t)fsize) {
-        fprintf(stderr, "fread failed\n");
-        free(buf);
-        return -1;
-    }
-
-    // 只传文件名，不传路径（避免路径注入 & 便于接收端落盘）
+// 提取文件名
+// 只传文件名，不传路径（避免路径注入 & 便于接收端落盘）
+static int file_base_name(const char *path, char *out_name, size_t name_cap) {
     char *path_copy = strdup(path);                         // 复制路径以获取文件名
     if (!path_copy) {
-        free(buf);
         return -1;
     }
     char *name = basename(path_copy);                       // 获取文件名
     if (strlen(name) >= name_cap) {
         fprintf(stderr, "file name too long\n");
         free(path_copy);
-        free(buf);
         return -1;
     }
     strncpy(out_name, name, name_cap);
     out_name[name_cap - 1] = '\0';                         // 保险截断
     free(path_copy);
-
-    *out_buf = buf;
-    *out_len = (size_t)fsize;
     return 0;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 4) {
-        fprintf(stderr, "Usage: %s <receiver_ip> <port> <file_path>\n", argv[0]);
-        return 1;
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ===================== 读取计划（多文件） =====================
+// 按命令行顺序逐个读文件，在机械盘或碎片化的文件系统上就是随机 I/O。读之前先排计划：
+// - 用 FIEMAP 取每个文件的物理 extent，文件按第一个 extent 的物理偏移排序，按这个顺序分批发送
+// - 一批之内，所有文件的读段（extent）再统一按物理偏移排序后读，磁头只朝一个方向走
+// - 第一批在建连时、之后每批在上一批传输时，先发 POSIX_FADV_WILLNEED，让内核提前预读
+// 接收端按索引里的文件名落盘，发送顺序变了不影响结果
+// 取不到物理位置的部分（不支持 FIEMAP 的文件系统、延迟分配、内联数据、空洞）记为未知，
+// 排在已知部分之后，按文件内顺序读
+// RDMA_SIM_READ_PLAN=0 时保持命令行顺序，用于对比
+
+#define PLAN_MAX_EXTENTS 64               // 每个文件最多取的 extent 数，更碎的文件剩余部分按未知处理
+#define PHYS_UNKNOWN UINT64_MAX
+
+typedef struct {
+    const char *path;
+    uint64_t len;
+    uint64_t phys;                        // 第一个 extent 的物理偏移（排序键）
+    int order;                            // 命令行中的位置（键相同时保持原顺序）
+} plan_file_t;
+
+// 一次 pread：某个文件的一段
+typedef struct {
+    uint32_t file;                        // 本批内的文件下标
+    uint64_t logical;                     // 文件内偏移
+    uint64_t length;
+    uint64_t phys;                        // 磁盘上的物理偏移（PHYS_UNKNOWN 表示未知）
+} read_seg_t;
+
+// 用 FIEMAP 把文件 [0, len) 切成读段，返回段数
+// out 至少 2 * max_ext + 1 项（每个 extent 前面可能有一段空洞，末尾可能剩一段）
+// 内核不支持 FIEMAP（或 max_ext 为 0）时整个文件一段，物理位置未知
+static int file_segments(int fd, uint32_t file, uint64_t len, int max_ext, read_seg_t *out) {
+    struct fiemap *fm = (struct fiemap *)calloc(1, sizeof(struct fiemap) +
+                                                   (size_t)max_ext * sizeof(struct fiemap_extent));
+    if (!fm) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
     }
-    const char *server_ip = argv[1];                        // 接收端 IP
-    const char *port = argv[2];                             // 接收端端口
-    const char *file_path = argv[3];                        // 待发送文件路径
+    fm->fm_start = 0;
+    fm->fm_length = len;
+    fm->fm_extent_count = (uint32_t)max_ext;               // 不带 FIEMAP_FLAG_SYNC：不为排序强制回写脏页
+    uint32_t mapped = 0;
+    if (len > 0 && max_ext > 0 && ioctl(fd, FS_IOC_FIEMAP, fm) == 0) {  // max_ext 为 0 时内核只数不填
+        mapped = fm->fm_mapped_extents;
+    }
+    int n = 0;
+    uint64_t cur = 0;
+    for (uint32_t i = 0; i < mapped && cur < len; i++) {
+        const struct fiemap_extent *fe = &fm->fm_extents[i];
+        uint64_t end = fe->fe_logical + fe->fe_length;
+        if (end > len) {
+            end = len;
+        }
+        if (end <= cur) {
+            continue;
+        }
+        if (fe->fe_logical > cur) {
+            out[n++] = (read_seg_t){ file, cur, fe->fe_logical - cur, PHYS_UNKNOWN };   // 空洞
+            cur = fe->fe_logical;
+        }
+        int known = !(fe->fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC |
+                                      FIEMAP_EXTENT_DATA_INLINE));
+        out[n++] = (read_seg_t){ file, cur, end - cur,
+                                 known ? fe->fe_physical + (cur - fe->fe_logical) : PHYS_UNKNOWN };
+        cur = end;
+    }
+    if (cur < len) {
+        out[n++] = (read_seg_t){ file, cur, len - cur, PHYS_UNKNOWN };
+    }
+    free(fm);
+    return n;
+}
 
-    uint8_t *file_buf = NULL;                               // 文件内容缓冲区
-    size_t file_len = 0;                                    // 文件长度
-    char file_name[RDMA_MAX_NAME];                          // 文件名
-    if (read_file(file_path, &file_buf, &file_len, file_name, sizeof(file_name)) != 0) {
-        return 1;                                           // 读文件失败
+static int cmp_plan(const void *a, const void *b) {
+    const plan_file_t *x = (const plan_file_t *)a;
+    const plan_file_t *y = (const plan_file_t *)b;
+    if (x->phys != y->phys) {
+        return x->phys < y->phys ? -1 : 1;
+    }
+    return x->order - y->order;
+}
+
+static int cmp_seg(const void *a, const void *b) {
+    const read_seg_t *x = (const read_seg_t *)a;
+    const read_seg_t *y = (const read_seg_t *)b;
+    if (x->phys != y->phys) {
+        return x->phys < y->phys ? -1 : 1;
+    }
+    if (x->file != y->file) {
+        return x->file < y->file ? -1 : 1;
     }
+    return x->logical < y->logical ? -1 : (x->logical > y->logical);
+}
 
-    // 1) 地址解析：把 ip+port 解析为 RDMA CM 地址
-    struct rdma_addrinfo hints;                             // 地址解析提示
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_port_space = RDMA_PS_TCP;                      // TCP 语义的 RDMA CM
+typedef struct {
+    char name[RDMA_MAX_NAME];
+    const char *path;
+} name_ref_t;
 
-    struct rdma_addrinfo *res = NULL;                       // 解析结果
-    if (rdma_getaddrinfo((char *)server_ip, (char *)port, &hints, &res) != 0) {
-        perror("rdma_getaddrinfo");
-        free(file_buf);
-        return 1;
+static int cmp_name_ref(const void *a, const void *b) {
+    return strcmp(((const name_ref_t *)a)->name, ((const name_ref_t *)b)->name);
+}
+
+// 接收端只按文件名落盘：不同目录下的同名文件会互相覆盖，发送前直接拒绝
+static int check_unique_names(char **paths, int count) {
+    name_ref_t *refs = (name_ref_t *)calloc((size_t)count, sizeof(*refs));
+    if (!refs) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+    int rc = 0;
+    for (int i = 0; i < count && rc == 0; i++) {
+        rc = file_base_name(paths[i], refs[i].name, sizeof(refs[i].name));
+        refs[i].path = paths[i];
+    }
+    if (rc == 0) {
+        qsort(refs, (size_t)count, sizeof(*refs), cmp_name_ref);
+        for (int i = 1; i < count; i++) {
+            if (strcmp(refs[i - 1].name, refs[i].name) == 0) {
+                fprintf(stderr, "duplicate file name %s: %s and %s\n", refs[i].name,
+                        refs[i - 1].path, refs[i].path);
+                rc = -1;
+                break;
+            }
+        }
     }
+    free(refs);
+    return rc;
+}
 
-    // 2) 创建事件通道 + CM ID
-    struct rdma_event_channel *ec = rdma_create_event_channel();
-    if (!ec) {
-        perror("rdma_create_event_channel");
-        rdma_freeaddrinfo(res);
-        free(file_buf);
-        return 1;
+// 读之前排好发送顺序：校验每个文件（含重名），取第一个 extent 的物理偏移，排序
+static int build_plan(char **paths, int count, int ordered, plan_file_t *plan) {
+    if (check_unique_names(paths, count) != 0) {
+        return -1;
+    }
+    int known = 0;
+    for (int i = 0; i < count; i++) {
+        int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            perror(paths[i]);
+            return -1;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            fprintf(stderr, "%s: not a regular file\n", paths[i]);
+            close(fd);
+            return -1;
+        }
+        plan[i].path = paths[i];
+        plan[i].len = (uint64_t)st.st_size;
+        plan[i].phys = PHYS_UNKNOWN;
+        plan[i].order = i;
+        read_seg_t segs[3];
+        int n = ordered ? file_segments(fd, 0, plan[i].len, 1, segs) : 0;
+        close(fd);
+        if (n < 0) {
+            return -1;
+        }
+        for (int k = 0; k < n && plan[i].phys == PHYS_UNKNOWN; k++) {
+            plan[i].phys = segs[k].phys;
+        }
+        known += plan[i].phys != PHYS_UNKNOWN;
     }
+    if (ordered) {
+        qsort(plan, (size_t)count, sizeof(*plan), cmp_plan);
+    }
+    printf("[sender] read plan: %d files, %d with known layout, %s\n", count, known,
+           ordered ? "ordered by physical offset" : "command-line order");
+    return 0;
+}
 
-    struct rdma_cm_id *id = NULL;
-    if (rdma_create_id(ec, &id, NULL, RDMA_PS_TCP) != 0) {
-        perror("rdma_create_id");
-        rdma_freeaddrinfo(res);
-        rdma_destroy_event_channel(ec);
-        free(file_buf);
-        return 1;
+// 从 plan[start] 开始的一批包含哪些文件：返回本批之后的下一个下标
+// 规则：数量不超过 RDMA_BATCH_MAX_FILES，数据总量不超过 RDMA_BATCH_BYTES
+// （进批的文件都不超过 RDMA_BATCH_BYTES，大文件已由 split_large 拆出去）
+static int batch_span(const plan_file_t *plan, int count, int start) {
+    uint64_t data_bytes = 0;
+    int end = start;
+    while (end < count && end - start < RDMA_BATCH_MAX_FILES) {
+        if (end > start && data_bytes + plan[end].len > RDMA_BATCH_BYTES) {
+            break;                                          // 放不下，留给下一批
+        }
+        data_bytes += plan[end].len;
+        end++;
     }
+    return end;
+}
 
-    // 3) 解析地址与路由（RDMA CM 必需步骤）
-    if (rdma_resolve_addr(id, NULL, res->ai_dst_addr, 2000) != 0) {
-        perror("rdma_resolve_addr");
-        rdma_freeaddrinfo(res);
-        rdma_destroy_id(id);
-        rdma_destroy_event_channel(ec);
-        free(file_buf);
-        return 1;
+// 预读提示：下一批的文件按计划顺序交给内核预读，与当前批的传输重叠
+static void prefetch_batch(const plan_file_t *plan, int count, int start) {
+    int end = batch_span(plan, count, start);
+    for (int i = start; i < end; i++) {
+        int fd = open(plan[i].path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;                                       // 只是提示，真正读的时候再报错
+        }
+        posix_fadvise(fd, 0, (off_t)plan[i].len, POSIX_FADV_WILLNEED);
+        close(fd);
     }
-    if (rdma_wait_event(ec, RDMA_CM_EVENT_ADDR_RESOLVED, NULL) != 0) {
-        fprintf(stderr, "ADDR_RESOLVED failed\n");
-        rdma_freeaddrinfo(res);
-        rdma_destroy_id(id);
-        rdma_destroy_event_channel(ec);
-        free(file_buf);
-        return 1;
+}
+
+// 把超过 RDMA_BATCH_BYTES 的大文件挪到计划末尾（两部分各自保持计划顺序），返回小文件个数
+// 大文件不进暂存区：整个读进内存再注册成一个 MR 会让两端都占用与文件等大的内存，
+// 改为批量会话结束后逐个走单文件的分块路径
+static int split_large(plan_file_t *plan, int count) {
+    plan_file_t *large = (plan_file_t *)malloc((size_t)count * sizeof(*plan));
+    if (!large) {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
     }
-    if (rdma_resolve_route(id, 2000) != 0) {
-        perror("rdma_resolve_route");
-        rdma_freeaddrinfo(res);
-        rdma_destroy_id(id);
-        rdma_destroy_event_channel(ec);
-        free(file_buf);
-        return 1;
+    int nsmall = 0;
+    int nlarge = 0;
+    for (int i = 0; i < count; i++) {
+        if (plan[i].len > RDMA_BATCH_BYTES) {
+            large[nlarge++] = plan[i];
+        } else {
+            plan[nsmall++] = plan[i];
+        }
     }
-    if (rdma_wait_event(ec, RDMA_CM_EVENT_ROUTE_RESOLVED, NULL) != 0) {
-        fprintf(stderr, "ROUTE_RESOLVED failed\n");
-        rdma_freeaddrinfo(res);
-        rdma_destroy_id(id);
-        rdma_destroy_event_channel(ec);
-        free(file_buf);
-        return 1;
+    memcpy(plan + nsmall, large, (size_t)nlarge * sizeof(*plan));
+    free(large);
+    return nsmall;
+}
+
+// ===================== 小文件批量模式 =====================
+// 思路：把很多小文件打包进对端的一块区域，一次 BATCH/MR/FIN/ACK 往返搬运一整批
+// - 本地：每个文件按页对齐放在暂存区的独立槽位里（整块暂存区只注册一个 MR）
+// - 远端：索引 + 文件数据紧密排列
+// - 中间：用多 SGE 聚合写，把本地不连续的槽位“拼”成远端的连续数据
+// 这样每个文件的开销（WR、完成事件、连接）被整批摊薄
+
+// 批量写入时最多同时在途的 WR 数（不超过 QP 发送深度）
+#define BATCH_SEND_WINDOW 8
+
+// 一批文件的本地暂存区
+// 布局：[索引区][文件1槽位][文件2槽位]...（每段起点按 RDMA_BATCH_ALIGN 对齐）
+typedef struct {
+    uint8_t *arena;           // 暂存区（整体注册一个 MR）
+    size_t arena_len;         // 暂存区长度
+    uint32_t file_count;      // 本批文件数量
+    uint64_t index_len;       // 索引区有效长度
+    uint64_t total_size;      // 远端区域总大小（索引 + 数据）
+    size_t *slot_off;         // 每个文件在暂存区中的偏移
+    uint64_t *file_len;       // 每个文件的长度
+} batch_t;
+
+static size_t align_up(size_t v, size_t a) {
+    return (v + a - 1) / a * a;
+}
+
+static void batch_free(batch_t *b) {
+    free(b->arena);
+    free(b->slot_off);
+    free(b->file_len);
+    memset(b, 0, sizeof(*b));
+}
+
+// 把 fd 中 [off, off + len) 完整读到 buf（处理短读）
+static int read_full(int fd, uint8_t *buf, uint64_t off, uint64_t len) {
+    uint64_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, (size_t)(len - done), (off_t)(off + done));
+        if (n < 0 && errno == EINTR) {
+            continue;                                       // 被信号打断，重试
+        }
+        if (n <= 0) {
+            return -1;                                      // 出错或文件被截断
+        }
+        done += (uint64_t)n;
     }
-    rdma_freeaddrinfo(res);
-
-    // 4) 创建 QP/CQ/PD（通信与完成机制）
-    struct ibv_pd *pd = NULL;
-    struct ibv_cq *cq = NULL;
-    struct ibv_comp_channel *comp_chan = NULL;
-    if (rdma_build_qp(id, &pd, &cq, &comp_chan) != 0) {
-        fprintf(stderr, "rdma_build_qp failed\n");
-        rdma_destroy_id(id);
-        rdma_destroy_event_channel(ec);
-        free(file_buf);
-        return 1;
+    return 0;
+}
+
+// 装载 plan[start, end) 这一批文件（end 由 batch_span 决定）
+// ordered 时各文件按 extent 切成读段，本批所有读段按物理偏移排序后再读
+static int load_batch(const plan_file_t *plan, int start, int end, int ordered, batch_t *b) {
+    memset(b, 0, sizeof(*b));
+    uint32_t n = (uint32_t)(end - start);
+    b->slot_off = (size_t *)calloc(n ? (size_t)n : 1, sizeof(size_t));     // 空批：只有声明
+    b->file_len = (uint64_t *)calloc(n ? (size_t)n : 1, sizeof(uint64_t));
+    if (!b->slot_off || !b->file_len) {
+        fprintf(stderr, "malloc failed\n");
+        batch_free(b);
+        return -1;
     }
 
-    // 5) 注册 MR
-    // - file_mr：文件内容，作为 RDMA Write 的本地源
-    // - ctrl_mr：HELLO / MR_INFO / ACK 等控制消息
-    struct ibv_mr *file_mr = NULL;
-    if (rdma_register_mr(pd, file_buf, file_len, IBV_ACCESS_LOCAL_WRITE, &file_mr) != 0) {
-        fprintf(stderr, "register file MR failed\n");
-        rdma_destroy_id(id);
-        rdma_destroy_event_channel(ec);
-        free(file_buf);
-        return 1;
+    // 1) 文件长度取自计划（读之前已经校验过）
+    uint64_t data_bytes = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        b->file_len[i] = plan[start + (int)i].len;
+        data_bytes += b->file_len[i];
+    }
+    b->file_count = n;
+    b->index_len = (uint64_t)n * sizeof(rdma_batch_entry_t);
+    b->total_size = b->index_len + data_bytes;
+
+    // 2) 计算暂存区布局（每个槽位页对齐）
+    size_t off = align_up((size_t)b->index_len, RDMA_BATCH_ALIGN);
+    for (uint32_t i = 0; i < n; i++) {
+        b->slot_off[i] = off;
+        off += align_up((size_t)b->file_len[i], RDMA_BATCH_ALIGN);
+    }
+    b->arena_len = off ? off : RDMA_BATCH_ALIGN;
+    void *arena = NULL;
+    if (posix_memalign(&arena, RDMA_BATCH_ALIGN, b->arena_len) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        batch_free(b);
+        return -1;
     }
+    b->arena = (uint8_t *)arena;
+    memset(b->arena, 0, (size_t)b->index_len);
 
-    rdma_ctrl_hello_t hello;                                 // HELLO 消息
-    memset(&hello, 0, sizeof(hello));
-    hello.type = htonl(RDMA_CTRL_HELLO);
-    hello.name_len = htonl((uint32_t)strlen(file_name));
-    hello.file_size = htobe64((uint64_t)file_len);
-    strncpy(hello.name, file_name, RDMA_MAX_NAME - 1);
+    // 3) 填索引（offset 是远端区域中的偏移，紧密排列），同时收集读段
+    rdma_batch_entry_t *entries = (rdma_batch_entry_t *)b->arena;
+    uint64_t remote_off = b->index_len;
+    read_seg_t *segs = NULL;
+    size_t nseg = 0;
+    size_t seg_cap = 0;
+    int max_ext = ordered ? PLAN_MAX_EXTENTS : 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const char *path = plan[start + (int)i].path;
+        char name[RDMA_MAX_NAME];
+        if (file_base_name(path, name, sizeof(name)) != 0) {
+            goto fail;
+        }
+        entries[i].offset = htobe64(remote_off);
+        entries[i].length = htobe64(b->file_len[i]);
+        entries[i].name_len = htonl((uint32_t)strlen(name));
+        strncpy(entries[i].name, name, RDMA_MAX_NAME - 1);
+        remote_off += b->file_len[i];
 
-    rdma_ctrl_mr_t mr_info;                                  // 接收端 MR 信息（接收用）
-    memset(&mr_info, 0, sizeof(mr_info));
+        if (nseg + 2 * PLAN_MAX_EXTENTS + 1 > seg_cap) {
+            seg_cap = seg_cap ? seg_cap * 2 : 4 * (2 * PLAN_MAX_EXTENTS + 1);
+            read_seg_t *grown = (read_seg_t *)realloc(segs, seg_cap * sizeof(*segs));
+            if (!grown) {
+                fprintf(stderr, "malloc failed\n");
+                goto fail;
+            }
+            segs = grown;
+        }
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            perror(path);
+            goto fail;
+        }
+        int k = file_segments(fd, i, b->file_len[i], max_ext, segs + nseg);
+        close(fd);
+        if (k < 0) {
+            goto fail;
+        }
+        nseg += (size_t)k;
+    }
+
+    // 4) 按物理偏移读（未知的排在最后，按文件、文件内偏移）；同一文件的连续读段复用 fd
+    if (nseg > 1) {
+        qsort(segs, nseg, sizeof(*segs), cmp_seg);
+    }
+    int fd = -1;
+    uint32_t fd_file = 0;
+    for (size_t k = 0; k < nseg; k++) {
+        const read_seg_t *sg = &segs[k];
+        const char *path = plan[start + (int)sg->file].path;
+        if (fd < 0 || fd_file != sg->file) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            fd = open(path, O_RDONLY | O_CLOEXEC);
+            fd_file = sg->file;
+            if (fd < 0) {
+                perror(path);
+                goto fail;
+            }
+        }
+        if (read_full(fd, b->arena + b->slot_off[sg->file] + sg->logical, sg->logical, sg->length) != 0) {
+            fprintf(stderr, "%s: read failed\n", path);
+            close(fd);
+            goto fail;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(segs);
+    return 0;
 
-    rdma_ctrl_simple_t ack;                                  // ACK（接收用）
-    memset(&ack, 0, sizeof(ack));
+fail:
+    free(segs);
+    batch_free(b);
+    return -1;
+}
+
+// 发送一批文件：BATCH -> MR -> 多 SGE 聚合写 -> FIN -> ACK
+// more：最后一批里声明随后另起连接发送的大文件个数
+static int send_one_batch(rdma_disp_t *d, rdma_pacer_t *pacer, batch_t *b, int last, uint32_t more,
+                          int max_sge) {
+    rdma_ep_t *ep = d->ep;
+    rdma_mem_t arena_mem;
+    if (rdma_mem_reg(ep, b->arena, b->arena_len, IBV_ACCESS_LOCAL_WRITE, &arena_mem) != 0) {
+        fprintf(stderr, "register batch MR failed\n");
+        return -1;
+    }
 
-    struct ibv_mr *hello_mr = NULL;
-    struct ibv_mr *mr_info_mr = NULL;
-    struct ibv_mr *ack_mr = NULL;
+    // 控制消息缓冲区（每批复用同一套布局）
+    struct {
+        rdma_ctrl_batch_t batch;
+        rdma_ctrl_mr_t mr_info;
+        rdma_ctrl_simple_t fin;
+        rdma_ctrl_simple_t ack;
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.batch.type = htonl(RDMA_CTRL_BATCH);
+    ctrl.batch.file_count = htonl(b->file_count);
+    ctrl.batch.total_size = htobe64(b->total_size);
+    ctrl.batch.flags = htonl(last ? RDMA_BATCH_F_LAST : 0);
+    ctrl.batch.more = htonl(last ? more : 0);
+    ctrl.fin.type = htonl(RDMA_CTRL_FIN);
 
-    if (rdma_register_mr(pd, &hello, sizeof(hello), IBV_ACCESS_LOCAL_WRITE, &hello_mr) != 0 ||
-        rdma_register_mr(pd, &mr_info, sizeof(mr_info), IBV_ACCESS_LOCAL_WRITE, &mr_info_mr) != 0 ||
-        rdma_register_mr(pd, &ack, sizeof(ack), IBV_ACCESS_LOCAL_WRITE, &ack_mr) != 0) {
+    rdma_mem_t ctrl_mem;
+    if (rdma_mem_reg(ep, &ctrl, sizeof(ctrl), IBV_ACCESS_LOCAL_WRITE, &ctrl_mem) != 0) {
         fprintf(stderr, "register ctrl MR failed\n");
-        rdma_destroy_id(id);
-        rdma_destroy_event_channel(ec);
-        free(file_buf);
-        return 1;
+        rdma_mem_dereg(ep, &arena_mem);
+        return -1;
     }
 
-    // 6) 预投递接收 MR_INFO
-    // 关键点：Send/Recv 必须先 post_recv，否则对端 send 可能失败
-    if (rdma_post_recv(id, &mr_info, sizeof(mr_info), mr_info_mr, 1) != 0) {
-        fprintf(stderr, "post recv MR_INFO failed\n");
-        return 1;
+    int rc = -1;
+    rdma_req_t r_mr = {0}, r_batch = {0}, r_ack = {0}, r_fin = {0};
+    rdma_req_t r_write[BATCH_SEND_WINDOW];                  // 在途 Write（按序号轮转复用）
+    memset(r_write, 0, sizeof(r_write));
+
+    // 1) 先挂接收 MR_INFO，再发 BATCH
+    if (rdma_disp_post_recv(d, &r_mr, &ctrl.mr_info, sizeof(ctrl.mr_info), &ctrl_mem) != 0 ||
+        rdma_disp_post_send(d, &r_batch, &ctrl.batch, sizeof(ctrl.batch), &ctrl_mem) != 0) {
+        fprintf(stderr, "post BATCH failed\n");
+        goto out;
+    }
+    if (rdma_disp_wait(d, &r_batch) != 0 || rdma_disp_wait(d, &r_mr) != 0) {
+        fprintf(stderr, "BATCH/MR_INFO completion failed\n");
+        goto out;
+    }
+    if (ntohl(ctrl.mr_info.type) != RDMA_CTRL_MR) {
+        fprintf(stderr, "invalid MR_INFO type\n");
+        goto out;
+    }
+    uint64_t remote_addr = be64toh(ctrl.mr_info.addr);
+    uint32_t remote_rkey = ntohl(ctrl.mr_info.rkey);
+    if (be64toh(ctrl.mr_info.length) < b->total_size) {
+        fprintf(stderr, "remote MR too small\n");
+        goto out;
     }
 
-    // 7) 建立连接
-    struct rdma_conn_param conn_param;
-    memset(&conn_param, 0, sizeof(conn_param));
-    conn_param.initiator_depth = 1;
-    conn_param.responder_resources = 1;
-    conn_param.retry_count = 7;
-    if (rdma_connect(id, &conn_param) != 0) {
-        perror("rdma_connect");
-        return 1;
+    // 2) 多 SGE 聚合写
+    // SGE 顺序：索引 -> 文件1 -> 文件2 ...，每 max_sge 个组成一个 WR
+    // 远端地址按已写字节数递增，所以远端数据紧密排列
+    // 单个 SGE 不超过 RDMA_BATCH_BYTES（进批的文件本来就不超过它）
+    struct ibv_sge sges[RDMA_MAX_SGE];
+    int nsge = 0;
+    uint64_t wr_bytes = 0;                                  // 当前 WR 已聚合的字节数
+    uint64_t remote_off = 0;                                // 当前 WR 的远端起始偏移
+    uint64_t posted = 0;                                    // 已投递的 WR 数
+    uint32_t file_idx = 0;
+    const uint8_t *seg = b->arena;                          // 当前待切分的本地段
+    uint64_t seg_left = b->index_len;                       // 当前段剩余字节
+    while (1) {
+        while (seg_left == 0 && file_idx < b->file_count) {
+            seg = b->arena + b->slot_off[file_idx];         // 切到下一个文件槽位
+            seg_left = b->file_len[file_idx];
+            file_idx++;
+        }
+        int done = (seg_left == 0);
+        if (!done) {
+            uint64_t piece = seg_left < RDMA_BATCH_BYTES ? seg_left : RDMA_BATCH_BYTES;
+            sges[nsge].addr = (uintptr_t)seg;
+            sges[nsge].length = (uint32_t)piece;
+            sges[nsge].lkey = arena_mem.lkey;
+            nsge++;
+            wr_bytes += piece;
+            seg += piece;
+            seg_left -= piece;
+        }
+        if (nsge == max_sge || (done && nsge > 0)) {
+            rdma_req_t *w = &r_write[posted % BATCH_SEND_WINDOW];
+            if (posted >= BATCH_SEND_WINDOW && rdma_disp_wait(d, w) != 0) {
+                fprintf(stderr, "RDMA write completion failed\n");
+                goto out;
+            }
+            rdma_pacer_take(pacer, (size_t)wr_bytes);
+            if (rdma_disp_post_write(d, w, sges, nsge, remote_addr + remote_off, remote_rkey) != 0) {
+                fprintf(stderr, "post RDMA write failed\n");
+                goto out;
+            }
+            posted++;
+            remote_off += wr_bytes;
+            wr_bytes = 0;
+            nsge = 0;
+        }
+        if (done) {
+            break;
+        }
     }
-    if (rdma_wait_event(ec, RDMA_CM_EVENT_ESTABLISHED, NULL) != 0) {
-        fprintf(stderr, "ESTABLISHED failed\n");
-        return 1;
+    if (rdma_disp_drain(d) != 0) {                          // 此时在途的只有 Write
+        fprintf(stderr, "RDMA write completion failed\n");
+        goto out;
     }
 
-    // 8) 发送 HELLO（让接收端准备 MR）
-    if (rdma_post_send(id, &hello, sizeof(hello), hello_mr, 2) != 0) {
-        fprintf(stderr, "post send HELLO failed\n");
-        return 1;
+    // 3) FIN / ACK
+    if (rdma_disp_post_recv(d, &r_ack, &ctrl.ack, sizeof(ctrl.ack), &ctrl_mem) != 0 ||
+        rdma_disp_post_send(d, &r_fin, &ctrl.fin, sizeof(ctrl.fin), &ctrl_mem) != 0) {
+        fprintf(stderr, "post FIN failed\n");
+        goto out;
     }
-    if (rdma_poll_cq(cq, IBV_WC_SEND, NULL) != 0) {
-        fprintf(stderr, "HELLO send completion failed\n");
-        return 1;
+    if (rdma_disp_wait(d, &r_fin) != 0 || rdma_disp_wait(d, &r_ack) != 0) {
+        fprintf(stderr, "FIN/ACK completion failed\n");
+        goto out;
     }
+    if (ntohl(ctrl.ack.type) != RDMA_CTRL_ACK) {
+        fprintf(stderr, "invalid ACK type\n");
+        goto out;
+    }
+    rc = 0;
 
-    // 9) 接收 MR_INFO（拿到远端 addr/rkey）
-    if (rdma_poll_cq(cq, IBV_WC_RECV, NULL) != 0) {
-        fprintf(stderr, "MR_INFO recv completion failed\n");
+out:
+    rdma_mem_dereg(ep, &ctrl_mem);
+    rdma_mem_dereg(ep, &arena_mem);
+    return rc;
+}
+
+// 批量会话：按计划顺序逐批装载、发送 plan[0, count)
+// more：随后另起连接发送的大文件个数（在最后一批里声明；没有小文件时只发一条空批）
+static int send_batches(rdma_disp_t *d, rdma_pacer_t *pacer, const plan_file_t *plan, int count,
+                        uint32_t more, int ordered) {
+    int max_sge = rdma_ep_max_sge(d->ep);
+    printf("[sender] batch mode: %d files, %u large, max_sge=%d\n", count, more, max_sge);
+
+    int start = 0;
+    int batches = 0;
+    uint64_t read_ns = 0;                                   // 统计：装载（读文件）耗时
+    uint64_t read_bytes = 0;
+    int rc = 0;
+    do {
+        batch_t b;
+        int end = batch_span(plan, count, start);
+        uint64_t t0 = now_ns();
+        if (load_batch(plan, start, end, ordered, &b) != 0) {
+            rc = -1;
+            break;
+        }
+        read_ns += now_ns() - t0;
+        read_bytes += b.total_size - b.index_len;
+        if (end < count) {
+            prefetch_batch(plan, count, end);               // 下一批的读与本批的传输重叠
+        }
+        rc = send_one_batch(d, pacer, &b, end == count, more, max_sge);
+        batch_free(&b);
+        if (rc != 0) {
+            break;
+        }
+        batches++;
+        start = end;
+    } while (start < count);
+    if (rc != 0) {
+        return -1;
+    }
+    printf("[sender] sent %d files in %d batches\n", count, batches);
+    printf("[sender] read %.1f MB in %.1f ms (%.1f MB/s)\n", (double)read_bytes / 1e6,
+           (double)read_ns / 1e6, read_ns ? (double)read_bytes * 1e3 / (double)read_ns : 0.0);
+    return 0;
+}
+
+// 单文件：交给异步传输引擎（库接口），sender 只是它的一个薄封装
+// 批量模式里的大文件也逐个走这里（同一个引擎，一个接一个，接收端按顺序接受连接）
+static int send_file(rdma_engine_t *e, const char *ip, const char *port, const char *path) {
+    rdma_xfer_t *x = NULL;
+    int rc = rdma_xfer_submit_file(e, ip, port, path, NULL, NULL, &x);
+    if (rc == 0) {
+        rc = rdma_xfer_wait(x);
+    }
+    if (!x) {
+        return -1;
+    }
+    rdma_xfer_stats_t st;
+    rdma_xfer_stats(x, &st);
+    rdma_xfer_release(x);
+    if (rc != 0) {
+        return -1;
+    }
+    printf("[sender] connected via %s\n", rdma_xport_name(st.kind));
+    if (st.wrs > 0) {
+        printf("[sender] posted %u WRs in %llu calls: %.0f WR/s per core\n", st.wrs,
+               (unsigned long long)st.post_calls,
+               st.post_ns ? (double)st.wrs * 1e9 / (double)st.post_ns : 0.0);
+    }
+    if (st.paced_ns) {
+        printf("[sender] paced: waited %.1f ms\n", (double)st.paced_ns / 1e6);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <receiver_ip> <port> <file_path> [file_path ...]\n", argv[0]);
         return 1;
     }
+    const char *server_ip = argv[1];                        // 接收端 IP
+    const char *port = argv[2];                             // 接收端端口
+    int batch_mode = (argc > 4);                            // 多个文件：小文件批量模式
 
-    if (ntohl(mr_info.type) != RDMA_CTRL_MR) {
-        fprintf(stderr, "invalid MR_INFO type\n");
+    rdma_xport_kind_t kind;                                 // 传输后端（RDMA_SIM_TRANSPORT）
+    if (rdma_xport_from_env(&kind) != 0) {
         return 1;
     }
-    uint64_t remote_addr = be64toh(mr_info.addr);
-    uint32_t remote_rkey = ntohl(mr_info.rkey);
-    uint64_t remote_len = be64toh(mr_info.length);
-    if (file_len > remote_len) {
-        fprintf(stderr, "remote MR too small\n");
+
+    // QoS：每个数据 Write 投递前申请令牌（RDMA_SIM_RATE_MBPS / RDMA_SIM_PEER_RATE_MBPS / RDMA_SIM_PRIO）
+    rdma_pacer_t pacer;
+    if (rdma_pacer_open(&pacer, server_ip) != 0) {
         return 1;
     }
+    if (pacer.prio != RDMA_PRIO_NORMAL || pacer.slot->rate_bps ||
+        (pacer.peer && pacer.peer->rate_bps)) {
+        printf("[sender] qos: prio=%s rate=%.1fMB/s peer_rate=%.1fMB/s\n",
+               rdma_pace_prio_name(pacer.prio), (double)pacer.slot->rate_bps / 1e6,
+               pacer.peer ? (double)pacer.peer->rate_bps / 1e6 : 0.0);
+    }
 
-    // 10) 分块 RDMA Write
-    // 关键点：RDMA Write 是单边操作，接收端不会触发 recv
-    // 完成事件仍会在发送端 CQ 中出现，必须等待完成
-    uint64_t offset = 0;
-    while (offset < (uint64_t)file_len) {
-        uint32_t chunk = RDMA_CHUNK;
-        if (offset + chunk > (uint64_t)file_len) {
-            chunk = (uint32_t)((uint64_t)file_len - offset);
-        }
-        if (rdma_post_write(id, file_buf + offset, chunk, file_mr,
-                            remote_addr + offset, remote_rkey, 3) != 0) {
-            fprintf(stderr, "post RDMA write failed\n");
+    rdma_engine_t *e = NULL;
+    if (!batch_mode) {
+        rdma_pacer_close(&pacer);                           // 引擎为每个传输各开一个 pacer
+        if (rdma_engine_create(&e) != 0) {
+            fprintf(stderr, "create transfer engine failed\n");
             return 1;
         }
-        if (rdma_poll_cq(cq, IBV_WC_RDMA_WRITE, NULL) != 0) {
-            fprintf(stderr, "RDMA write completion failed\n");
+        int rc = send_file(e, server_ip, port, argv[3]);
+        rdma_engine_destroy(e);
+        if (rc != 0) {
             return 1;
         }
-        offset += chunk;
-    }
-
-    // 11) 发送 FIN，并等待 ACK
-    // 目的：让接收端知道“数据写完了，可以落盘”
-    if (rdma_post_recv(id, &ack, sizeof(ack), ack_mr, 4) != 0) {
-        fprintf(stderr, "post recv ACK failed\n");
-        return 1;
+        printf("[sender] done\n");
+        return 0;
     }
 
-    rdma_ctrl_simple_t fin;
-    memset(&fin, 0, sizeof(fin));
-    fin.type = htonl(RDMA_CTRL_FIN);
-    struct ibv_mr *fin_mr = NULL;
-    if (rdma_register_mr(pd, &fin, sizeof(fin), IBV_ACCESS_LOCAL_WRITE, &fin_mr) != 0) {
-        fprintf(stderr, "register FIN MR failed\n");
+    // 批量模式：建连之前先排好读取计划（含重名等校验），再把大文件拆出去
+    int count = argc - 3;
+    const char *rp = getenv("RDMA_SIM_READ_PLAN");
+    int ordered = !(rp && strcmp(rp, "0") == 0);
+    plan_file_t *plan = (plan_file_t *)calloc((size_t)count, sizeof(*plan));
+    if (!plan) {
+        fprintf(stderr, "malloc failed\n");
+        rdma_pacer_close(&pacer);
         return 1;
     }
-    if (rdma_post_send(id, &fin, sizeof(fin), fin_mr, 5) != 0) {
-        fprintf(stderr, "post send FIN failed\n");
-        return 1;
+    int nsmall = -1;
+    if (build_plan(&argv[3], count, ordered, plan) == 0) {
+        nsmall = split_large(plan, count);
     }
-    if (rdma_poll_cq(cq, IBV_WC_SEND, NULL) != 0) {
-        fprintf(stderr, "FIN send completion failed\n");
+    if (nsmall < 0) {
+        free(plan);
+        rdma_pacer_close(&pacer);
         return 1;
     }
+    prefetch_batch(plan, nsmall, 0);                        // 第一批的预读与建连重叠
 
-    if (rdma_poll_cq(cq, IBV_WC_RECV, NULL) != 0) {
-        fprintf(stderr, "ACK recv completion failed\n");
+    // 小文件：创建端点并建连，同一连接上逐批发送
+    // 每批自己注册暂存区与控制消息、挂接收，全部经分发器投递
+    rdma_ep_t *ep = NULL;
+    if (rdma_ep_create(kind, server_ip, port, &ep) != 0) {
+        fprintf(stderr, "create %s endpoint failed\n", rdma_xport_name(kind));
+        free(plan);
+        rdma_pacer_close(&pacer);
         return 1;
     }
-    if (ntohl(ack.type) != RDMA_CTRL_ACK) {
-        fprintf(stderr, "invalid ACK type\n");
+    rdma_disp_t disp;
+    rdma_disp_init(&disp, ep);
+    if (rdma_ep_connect(ep) != 0) {
+        fprintf(stderr, "connect failed\n");
+        rdma_ep_close(ep);
+        free(plan);
+        rdma_pacer_close(&pacer);
         return 1;
     }
+    printf("[sender] connected via %s\n", rdma_xport_name(rdma_ep_kind(ep)));
 
-    // 12) 资源释放
-    rdma_disconnect(id);
-    rdma_destroy_qp(id);
-    rdma_destroy_id(id);
-    rdma_destroy_event_channel(ec);
-    free(file_buf);
+    int rc = send_batches(&disp, &pacer, plan, nsmall, (uint32_t)(count - nsmall), ordered);
+    rdma_ep_close(ep);
+    if (pacer.waited_ns) {
+        printf("[sender] paced: waited %.1f ms\n", (double)pacer.waited_ns / 1e6);
+    }
+    rdma_pacer_close(&pacer);
 
+    // 大文件：批量会话结束后逐个走分块路径，接收端已从最后一批得知个数
+    if (rc == 0 && nsmall < count) {
+        if (rdma_engine_create(&e) != 0) {
+            fprintf(stderr, "create transfer engine failed\n");
+            rc = -1;
+        }
+        for (int i = nsmall; rc == 0 && i < count; i++) {
+            rc = send_file(e, server_ip, port, plan[i].path);
+        }
+        if (e) {
+            rdma_engine_destroy(e);
+        }
+    }
+    free(plan);
+    if (rc != 0) {
+        return 1;
+    }
     printf("[sender] done\n");
     return 0;
 }